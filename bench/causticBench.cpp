@@ -0,0 +1,173 @@
+// Flux in the brightest spots of the caustic under the glass mesh of the Cornell box, split
+// between the photon maps the integrator gathers from. Light reaching a diffuse surface after
+// at least one bounce is either a caustic, in the caustic map, or has bounced off a diffuse
+// surface, in the global map, and no path may be in both. The sum of the two maps in the
+// caustic is checked against a reference map of every bounced photon, for the global map
+// traced per path and in wavefronts. The reference draws from the random streams of the
+// per path global map, so the two differ only by the caustic paths. A caustic counted in
+// both maps adds about half again. Exits with 1 if either sum is off by more than --tolerance.
+// Built by the top-level CMakeLists.txt, run from the bench directory, e.g.
+//   cmake -S .. -B ../build && cmake --build ../build
+//   ../build/bench/causticBench [options]
+//     --resources dir     meshes, default ../resources
+//     --emissions n       global, caustic and reference emissions, default 200000 each
+//     --points n          spots the flux is summed in, default 32
+//     --radius r          radius of the spots, default 0.1
+//     --tolerance t       largest relative difference to the reference, default 0.15
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include "kdTree.hpp"
+#include "photonTracing.hpp"
+#include "wavefront.hpp"
+#include "lightBVH.hpp"
+#include "cornellBox.hpp"
+
+// trace one photon and store it at every diffuse hit after a bounce, specular or diffuse,
+// the light the global and the caustic map split between them
+void traceReferencePhoton(Scene* scene, Map& photonMap)
+{
+	Eigen::Vector3f lightPos, lightDir, power;
+	if (!emitPhoton(scene, lightPos, lightDir, power))
+		return;
+	Ray ray(lightPos, lightDir);
+	ray.m_Width = scene->photonFootprint;
+	Interaction hit;
+	bool bounced = false;
+	while (scene->intersection(&ray, hit))
+	{
+		if (((BSDF*)hit.material)->isSpecular == true)
+		{
+			if (!specularBounce(hit, ray, power))
+				return;
+		}
+		else
+		{
+			hit.inputDir = -ray.m_Dir;
+			if (bounced)
+				photonMap.store(hit.entryPoint, hit.inputDir, power);
+			if (!diffuseRussianRoulette(hit.surfaceColor, power))
+				return;
+			((BSDF*)hit.material)->sample(hit);
+			ray.m_Ori = hit.entryPoint;
+			ray.m_Dir = hit.outputDir;
+		}
+		bounced = true;
+	}
+}
+
+// the @count photons of @map with the most photons of @map within @radius, out of about
+// 2000 candidates, where the caustic is the brightest
+std::vector<Eigen::Vector3f> brightestSpots(const Map& map, int count, float radius)
+{
+	std::vector<std::pair<int, int>> neighbours;	// minus the neighbour count, photon
+	for (int i = 1; i <= map.stored_photons; i += std::max(map.stored_photons / 2000, 1))
+	{
+		int n = 0;
+		for (int j = 1; j <= map.stored_photons; j++)
+			if ((map.photons[j].pos - map.photons[i].pos).squaredNorm() < radius * radius)
+				n++;
+		neighbours.push_back(std::make_pair(-n, i));
+	}
+	std::sort(neighbours.begin(), neighbours.end());
+	std::vector<Eigen::Vector3f> spots;
+	for (int k = 0; k < count && k < (int)neighbours.size(); k++)
+		spots.push_back(map.photons[neighbours[k].second].pos);
+	return spots;
+}
+
+// flux of the photons of @map within @radius of every point of @centers, a point counts a
+// photon near several of them as often
+double flux(const Map& map, const std::vector<Eigen::Vector3f>& centers, float radius)
+{
+	double sum = 0.0;
+	for (int i = 1; i <= map.stored_photons; i++)
+	{
+		const Photon& photon = map.photons[i];
+		for (const Eigen::Vector3f& center : centers)
+			if ((photon.pos - center).squaredNorm() < radius * radius)
+				sum += LightBVH::luminance(photon.power);
+	}
+	return sum;
+}
+
+int main(int argc, char** argv)
+{
+	std::string resources = "../resources";
+	int emissions = 200000;
+	int spots = 32;
+	float radius = 0.1f;
+	double tolerance = 0.15;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--resources" && i + 1 < argc)
+			resources = argv[++i];
+		else if (arg == "--emissions" && i + 1 < argc)
+			emissions = std::atoi(argv[++i]);
+		else if (arg == "--points" && i + 1 < argc)
+			spots = std::atoi(argv[++i]);
+		else if (arg == "--radius" && i + 1 < argc)
+			radius = (float)std::atof(argv[++i]);
+		else if (arg == "--tolerance" && i + 1 < argc)
+			tolerance = std::atof(argv[++i]);
+		else
+		{
+			std::cerr << "unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	CornellBox box(resources + "/p.obj");
+	Scene* scene = &box.scene;
+	scene->photonFootprint = photonFootprint(*scene, emissions);
+	Eigen::Vector3f white(1, 1, 1);
+	Map global(10 * emissions, white), wavefrontGlobal(10 * emissions, white), caustic(emissions, white);
+	Map reference(10 * emissions, white), centers(emissions, white);
+
+	globalPhotonShard(scene, global, 0, emissions, 1);
+	causticsPhotonShard(scene, caustic, 0, emissions, 2);
+	threadSampler().setSeed(3);
+	WavefrontPhotonTracer tracer(scene);
+	tracer.seed = 3;
+	tracer.traceGlobal(wavefrontGlobal, emissions);
+	for (int i = 0; i < emissions; i++)
+	{
+		threadSampler().setSeed(1, (uint64_t)i);	// the streams of globalPhotonShard
+		traceReferencePhoton(scene, reference);
+	}
+	reference.emitted_photons = emissions;
+	// the spots are found from caustic photons of other random streams, so the noise of the
+	// caustic map does not pick them
+	causticsPhotonShard(scene, centers, 0, emissions, 5);
+	for (Map* map : { &global, &wavefrontGlobal, &caustic, &reference })
+	{
+		if (map->stored_photons == map->max_photons)
+		{
+			std::cerr << "photon map full after " << map->stored_photons << " photons" << std::endl;
+			return 1;
+		}
+		map->scale_photon_power(1.0f / map->emitted_photons);
+	}
+	std::vector<Eigen::Vector3f> points = brightestSpots(centers, spots, radius);
+
+	double globalFlux = flux(global, points, radius), wavefrontFlux = flux(wavefrontGlobal, points, radius);
+	double causticFlux = flux(caustic, points, radius), referenceFlux = flux(reference, points, radius);
+	std::printf("map,flux,relativeToReference\n");
+	std::printf("reference,%g,1\n", referenceFlux);
+	std::printf("caustic,%g,%.4f\n", causticFlux, causticFlux / referenceFlux);
+	std::printf("global,%g,%.4f\n", globalFlux, globalFlux / referenceFlux);
+	std::printf("global+caustic,%g,%.4f\n", globalFlux + causticFlux, (globalFlux + causticFlux) / referenceFlux);
+	std::printf("wavefrontGlobal+caustic,%g,%.4f\n", wavefrontFlux + causticFlux, (wavefrontFlux + causticFlux) / referenceFlux);
+
+	bool agrees = std::fabs((globalFlux + causticFlux) / referenceFlux - 1.0) <= tolerance
+		&& std::fabs((wavefrontFlux + causticFlux) / referenceFlux - 1.0) <= tolerance;
+	if (!agrees)
+		std::cerr << "the photon maps do not add up to the reference in the caustic" << std::endl;
+	return agrees ? 0 : 1;
+}
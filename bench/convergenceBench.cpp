@@ -0,0 +1,268 @@
+// Equal-time convergence of render configurations on the Cornell box: every configuration
+// traces its photon maps and renders progressively until each time budget runs out, and its
+// error against a high-sample reference is reported next to the wall time it took.
+// Built by the top-level CMakeLists.txt, run from the bench directory, e.g.
+//   cmake -S .. -B ../build && cmake --build ../build
+//   ../build/bench/convergenceBench [options]
+//     --resources dir     meshes, default ../resources
+//     --res n             image size, default 128
+//     --budgets s,s,...   time budgets in seconds, default 2,4,8,16
+//     --reference-spp n   samples of the reference, default 1024; the reference is rendered
+//                         once and kept in reference_<res>_<spp>_<hash>.pfm, the hash covers
+//                         the scene description, the mesh files and the renderer sources
+//     --config name,globalEmissions,causticPhotons,gatherCount,passSamples
+//                         a configuration to compare, replaces the default set, repeatable
+//     --json              JSON instead of CSV
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include "camera.hpp"
+#include "kdTree.hpp"
+#include "photonTracing.hpp"
+#include "photonMappingIntegrator.hpp"
+#include "imageIO.hpp"
+#include "cornellBox.hpp"
+
+struct RenderConfig
+{
+	std::string name;
+	// photons emitted for the global map, caustic photons stored
+	int globalEmissions;
+	int causticPhotons;
+	// photons per density estimate
+	int gatherCount;
+	int passSamples;
+};
+
+struct Measurement
+{
+	std::string config;
+	double budget;
+	double seconds;
+	double photonSeconds;
+	int samples;
+	double rmse;
+	double relMSE;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// trace, scale and balance the photon maps of @config
+void tracePhotons(Scene& scene, const RenderConfig& config, std::unique_ptr<Map>& global, std::unique_ptr<Map>& caustic)
+{
+	// a global emission stores about two photons, leave room for long paths
+	global.reset(new Map(4 * config.globalEmissions, Eigen::Vector3f(1, 1, 1)));
+	caustic.reset(new Map(config.causticPhotons, Eigen::Vector3f(1, 1, 1)));
+	globalPhotonTracing(&scene, *global, config.globalEmissions);
+	causticsPhotonTracing(&scene, *caustic, config.causticPhotons);
+	global->scale_photon_power(1.0f / std::max(global->emitted_photons, 1));
+	caustic->scale_photon_power(1.0f / std::max(caustic->emitted_photons, 1));
+	global->balance();
+	caustic->balance();
+}
+
+// hash of the scene and of the code that renders it, this file and the headers in head/,
+// 0 if one of them cannot be read
+uint64_t referenceHash(const SceneDescription& description)
+{
+	namespace fs = std::filesystem;
+	std::error_code error;
+	fs::path source = fs::absolute(__FILE__, error);
+	std::vector<std::string> headers;
+	for (const fs::directory_entry& entry : fs::directory_iterator(source.parent_path().parent_path() / "head", error))
+		if (entry.path().extension() == ".hpp")
+			headers.push_back(entry.path().string());
+	if (error || headers.empty())
+		return 0;
+	std::sort(headers.begin(), headers.end());
+	uint64_t hash = hashFile(source.string());
+	for (const std::string& header : headers)
+		if (hash != 0)
+			hash = hashFile(header, hash);
+	uint64_t scene = description.hash();
+	if (hash == 0 || scene == 0)
+		return 0;
+	return hashBytes(&scene, sizeof(scene), hash);
+}
+
+// the reference image, loaded if an earlier run of the same scene and code left it behind
+Film referenceImage(CornellBox& box, int res, int samples)
+{
+	Scene& scene = box.scene;
+	std::unique_ptr<Camera> camera = box.newCamera(res);
+	uint64_t hash = referenceHash(box.description);
+	char name[64];
+	std::snprintf(name, sizeof(name), "reference_%d_%d_%016llx.pfm", res, samples, (unsigned long long)hash);
+	std::string path = hash != 0 ? name : "";
+	if (path.empty())
+		std::cerr << "cannot hash the scene and the sources, the reference is not kept" << std::endl;
+	else if (readPFM(path, camera->m_Film))
+		return camera->m_Film;
+
+	std::cerr << "rendering reference " << path << std::endl;
+	Clock::time_point start = Clock::now();
+	threadSampler().setSeed(1);
+	RenderConfig config = { "reference", 100000, 100000, 1000, 0 };
+	std::unique_ptr<Map> global, caustic;
+	tracePhotons(scene, config, global, caustic);
+	PhotonMappingIntegrator integrator(&scene, camera.get());
+	integrator.samples = samples;
+	integrator.adaptiveSampling = false;
+	integrator.render(*global, *caustic);
+	std::cerr << "reference took " << secondsSince(start) << "s" << std::endl;
+	if (!path.empty() && !writePFM(path, camera->m_Film))
+		std::cerr << "cannot write " << path << std::endl;
+	return camera->m_Film;
+}
+
+// root mean squared error over all channels, and the mean squared error relative to the
+// squared reference value, which weighs dark and bright regions alike
+void imageError(const Film& image, const Film& reference, double& rmse, double& relMSE)
+{
+	double squared = 0.0, relative = 0.0;
+	for (size_t i = 0; i < image.pixelSamples.size(); i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			double r = reference.pixelSamples[i][c];
+			double d = image.pixelSamples[i][c] - r;
+			squared += d * d;
+			relative += d * d / (r * r + 1e-2);
+		}
+	}
+	double n = 3.0 * image.pixelSamples.size();
+	rmse = std::sqrt(squared / n);
+	relMSE = relative / n;
+}
+
+// photon tracing counts against the budget, the render gets whatever is left
+Measurement measure(CornellBox& box, const RenderConfig& config, double budget, int res, const Film& reference)
+{
+	Scene& scene = box.scene;
+	Measurement m = { config.name, budget, 0.0, 0.0, 0, 0.0, 0.0 };
+	Clock::time_point start = Clock::now();
+	threadSampler().setSeed(2);
+	std::unique_ptr<Map> global, caustic;
+	tracePhotons(scene, config, global, caustic);
+	m.photonSeconds = secondsSince(start);
+
+	std::unique_ptr<Camera> camera = box.newCamera(res);
+	PhotonMappingIntegrator integrator(&scene, camera.get());
+	integrator.globalGatherCount = config.gatherCount;
+	integrator.causticGatherCount = config.gatherCount;
+	integrator.progressive = true;
+	integrator.passSamples = config.passSamples;
+	integrator.samples = 4096;
+	// the first pass always runs, so a budget used up by tracing still gives an image
+	integrator.timeBudget = std::max(budget - m.photonSeconds, 1e-6);
+	integrator.render(*global, *caustic);
+	m.seconds = secondsSince(start);
+	for (const PhotonMappingIntegrator::PassReport& report : integrator.passReports)
+		if (!report.skipped)
+			m.samples = report.samples;
+	imageError(camera->m_Film, reference, m.rmse, m.relMSE);
+	return m;
+}
+
+int main(int argc, char** argv)
+{
+	std::string resources = "../resources";
+	int res = 128, referenceSamples = 1024;
+	std::vector<double> budgets = { 2, 4, 8, 16 };
+	std::vector<RenderConfig> configs;
+	bool json = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--resources" && i + 1 < argc)
+			resources = argv[++i];
+		else if (arg == "--res" && i + 1 < argc)
+			res = std::atoi(argv[++i]);
+		else if (arg == "--reference-spp" && i + 1 < argc)
+			referenceSamples = std::atoi(argv[++i]);
+		else if (arg == "--budgets" && i + 1 < argc)
+		{
+			budgets.clear();
+			std::string list = argv[++i];
+			for (size_t pos = 0; pos < list.size(); )
+			{
+				size_t comma = std::min(list.find(',', pos), list.size());
+				budgets.push_back(std::atof(list.substr(pos, comma - pos).c_str()));
+				pos = comma + 1;
+			}
+		}
+		else if (arg == "--config" && i + 1 < argc)
+		{
+			RenderConfig config;
+			char name[64];
+			if (std::sscanf(argv[++i], "%63[^,],%d,%d,%d,%d", name, &config.globalEmissions, &config.causticPhotons,
+				&config.gatherCount, &config.passSamples) != 5 || config.passSamples < 1)
+			{
+				std::cerr << "bad --config " << argv[i] << std::endl;
+				return 1;
+			}
+			config.name = name;
+			configs.push_back(config);
+		}
+		else if (arg == "--json")
+			json = true;
+		else
+		{
+			std::cerr << "unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (configs.empty())
+	{
+		// the settings of src/main.cpp, then fewer and more photons and a smaller gather
+		configs = {
+			{ "baseline", 10000, 10000, 1000, 4 },
+			{ "fewPhotons", 2500, 2500, 250, 4 },
+			{ "manyPhotons", 40000, 40000, 1000, 4 },
+			{ "smallGather", 10000, 10000, 100, 4 },
+		};
+	}
+
+	CornellBox box(resources + "/p.obj");
+	Film reference = referenceImage(box, res, referenceSamples);
+	std::vector<Measurement> results;
+	for (const RenderConfig& config : configs)
+	{
+		for (double budget : budgets)
+		{
+			results.push_back(measure(box, config, budget, res, reference));
+			const Measurement& m = results.back();
+			std::cerr << m.config << " at " << m.budget << "s: " << m.samples << " spp in " << m.seconds << "s, rmse " << m.rmse << std::endl;
+		}
+	}
+
+	if (json)
+		std::printf("{\n  \"resolution\": %d,\n  \"referenceSamples\": %d,\n  \"results\": [\n", res, referenceSamples);
+	else
+		std::printf("config,budget,seconds,photonSeconds,samples,rmse,relMSE\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Measurement& m = results[i];
+		if (json)
+			std::printf("    { \"config\": \"%s\", \"budget\": %g, \"seconds\": %.4f, \"photonSeconds\": %.4f, \"samples\": %d, \"rmse\": %.6g, \"relMSE\": %.6g }%s\n",
+				m.config.c_str(), m.budget, m.seconds, m.photonSeconds, m.samples, m.rmse, m.relMSE, i + 1 < results.size() ? "," : "");
+		else
+			std::printf("%s,%g,%.4f,%.4f,%d,%.6g,%.6g\n", m.config.c_str(), m.budget, m.seconds, m.photonSeconds, m.samples, m.rmse, m.relMSE);
+	}
+	if (json)
+		std::printf("  ]\n}\n");
+	return 0;
+}
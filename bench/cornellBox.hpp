@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <memory>
+#include "scene.hpp"
+#include "camera.hpp"
+#include "triangleMesh.hpp"
+#include "sceneBundle.hpp"
+#include "sceneDescription.hpp"
+
+// the scene of src/main.cpp, built from the same description, by default the Cornell box
+// with the glass mesh at @meshPath and untextured walls
+struct CornellBox
+{
+	SceneDescription description;
+	SceneBundle bundle;
+	Scene scene;
+	// the last shape of the description, the one mesh of the Cornell box
+	TriangleMesh* mesh = nullptr;
+
+	explicit CornellBox(const std::string& meshPath) : CornellBox(cornellBox(meshPath)) {}
+
+	explicit CornellBox(const SceneDescription& sceneDescription) : description(sceneDescription)
+	{
+		description.build(bundle);
+		bundle.addTo(scene);
+		if (!description.meshes.empty())
+			mesh = static_cast<TriangleMesh*>(bundle.shapes.back().get());
+	}
+
+	// a camera of the description with a square film of @res pixels
+	std::unique_ptr<Camera> newCamera(int res) const
+	{
+		return std::unique_ptr<Camera>(new Camera(description.cameraPosition, description.cameraLookAt, description.cameraUp,
+			description.verticalFov, Eigen::Vector2i(res, res)));
+	}
+};
@@ -0,0 +1,81 @@
+// Photon emission from lights of very different power: a disc, quads, a sphere and a
+// triangle mesh. Emits photons with the lights picked proportionally to their power and,
+// for comparison, picked uniformly, and reports the cost per emission, the mean photon flux
+// against the total power of the lights and the spread of the photon flux. Picked by power
+// every photon carries the same flux, picked uniformly the dim lights get as many photons as
+// the bright ones and the flux of a photon depends on where it came from.
+// Built by the top-level CMakeLists.txt, run from the bench directory, e.g.
+//   cmake -S .. -B ../build && cmake --build ../build
+//   ../build/bench/emitterBench [emissions, default 1000000] [dim quads, default 64]
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include "scene.hpp"
+#include "light.hpp"
+#include "lightBVH.hpp"
+#include "photonTracing.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+// emit @emissions photons, print the cost and the statistics of their flux
+void emit(Scene& scene, const char* pick, int emissions, double totalPower)
+{
+	threadSampler().setSeed(3);
+	double sum = 0.0, sumSquares = 0.0;
+	int emitted = 0;
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < emissions; i++)
+	{
+		Eigen::Vector3f ori, dir, power;
+		if (!emitPhoton(&scene, ori, dir, power))
+			continue;
+		double flux = LightBVH::luminance(power);
+		sum += flux;
+		sumSquares += flux * flux;
+		emitted++;
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	// every emission counts, those that returned no photon carry zero flux
+	double mean = sum / emissions;
+	double deviation = std::sqrt(std::max(0.0, sumSquares / emissions - mean * mean));
+	std::printf("%s,%d,%d,%.1f,%.4f,%.4f,%.4f\n", pick, emissions, emitted, 1e9 * seconds / emissions,
+		mean, totalPower, deviation / mean);
+}
+
+int main(int argc, char** argv)
+{
+	int emissions = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	int dimQuads = argc > 2 ? std::atoi(argv[2]) : 64;
+
+	std::vector<std::unique_ptr<Light>> lights;
+	lights.emplace_back(new AreaLight(Eigen::Vector3f(0.0f, 5.8f, -5.0f), Eigen::Vector3f(1.0f, 1.0f, 1.0f)));
+	lights.emplace_back(new SphereLight(Eigen::Vector3f(-3.0f, 2.0f, -6.0f), 0.25f, Eigen::Vector3f(40.0f, 30.0f, 20.0f)));
+	// a small tetrahedron, its triangles wound to face outwards
+	Eigen::Vector3f a(3.0f, 0.0f, -6.0f), b(3.5f, 0.0f, -6.0f), c(3.25f, 0.0f, -5.5f), d(3.25f, 0.5f, -5.83f);
+	lights.emplace_back(new MeshLight({ a, b, c, a, d, b, b, d, c, c, d, a }, Eigen::Vector3f(2.0f, 4.0f, 8.0f)));
+	// a strip of dim panels along the back wall
+	for (int i = 0; i < dimQuads; i++)
+	{
+		Eigen::Vector3f corner(-6.0f + 12.0f * i / std::max(dimQuads, 1), -4.0f, -9.9f);
+		lights.emplace_back(new QuadLight(corner, Eigen::Vector3f(0.1f, 0.0f, 0.0f), Eigen::Vector3f(0.0f, 0.1f, 0.0f), Eigen::Vector3f(0.05f, 0.05f, 0.05f)));
+	}
+
+	Scene scene;
+	double totalPower = 0.0;
+	for (const std::unique_ptr<Light>& light : lights)
+	{
+		scene.addLight(light.get());
+		totalPower += LightBVH::luminance(light->getPower());
+	}
+
+	std::printf("pick,emissions,photons,nsPerEmission,meanFlux,totalPower,fluxCV\n");
+	emit(scene, "power", emissions, totalPower);
+	scene.emitters.build(std::vector<float>(lights.size(), 1.0f));
+	emit(scene, "uniform", emissions, totalPower);
+	return 0;
+}
@@ -0,0 +1,107 @@
+// Per-frame photon cost of a mesh moving through the Cornell box, incremental update against
+// a full trace. Every frame moves the mesh, traces again the paths the move touched and
+// rebuilds the maps, then traces the whole maps from scratch and checks that both agree.
+// Built by the top-level CMakeLists.txt, run from the bench directory, e.g.
+//   cmake -S .. -B ../build && cmake --build ../build
+//   ../build/bench/incrementalPhotonsBench [options]
+//     --resources dir     meshes, default ../resources
+//     --frames n          frames to move the mesh, default 8
+//     --emissions n       global and caustic emissions, default 20000 each
+//     --glass             keep the mesh glass, moving it re-aims every caustic photon
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "kdTree.hpp"
+#include "incrementalPhotons.hpp"
+#include "cornellBox.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool samePhotons(const Map& a, const Map& b)
+{
+	if (a.stored_photons != b.stored_photons || a.emitted_photons != b.emitted_photons)
+		return false;
+	for (int i = 1; i <= a.stored_photons; i++)
+	{
+		if (a.photons[i].pos != b.photons[i].pos || a.photons[i].power != b.photons[i].power)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	std::string resources = "../resources";
+	int frames = 8, emissions = 20000;
+	bool glass = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--resources" && i + 1 < argc)
+			resources = argv[++i];
+		else if (arg == "--frames" && i + 1 < argc)
+			frames = std::atoi(argv[++i]);
+		else if (arg == "--emissions" && i + 1 < argc)
+			emissions = std::atoi(argv[++i]);
+		else if (arg == "--glass")
+			glass = true;
+		else
+		{
+			std::cerr << "unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	SceneDescription description = cornellBox(resources + "/p.obj");
+	if (!glass)	// a grey diffuse mesh, a white one would let Russian roulette keep every photon
+	{
+		description.meshes[0].material = SceneDescription::DIFFUSE;
+		description.meshes[0].color = Eigen::Vector3f(0.7f, 0.7f, 0.7f);
+	}
+	CornellBox box(description);
+	int meshIndex = (int)box.scene.shapes.size() - 1;
+	const uint64_t seed = 9;
+	Map global(4 * emissions, Eigen::Vector3f(1, 1, 1)), caustic(emissions, Eigen::Vector3f(1, 1, 1));
+	Map fullGlobal(4 * emissions, Eigen::Vector3f(1, 1, 1)), fullCaustic(emissions, Eigen::Vector3f(1, 1, 1));
+
+	IncrementalPhotons photons(&box.scene, emissions, emissions, seed);
+	Clock::time_point start = Clock::now();
+	int paths = photons.traceAll();
+	photons.buildMaps(global, caustic);
+	std::cerr << paths << " paths traced in " << secondsSince(start) << "s" << std::endl;
+
+	std::printf("frame,retraced,paths,incrementalSeconds,fullSeconds,speedup,identical\n");
+	bool allIdentical = true;
+	for (int frame = 1; frame <= frames; frame++)
+	{
+		// a small step along the floor, towards the left wall
+		box.mesh->applyTransformation(Eigen::Affine3f(Eigen::Translation3f(-0.4f, 0.0f, 0.0f)));
+		box.mesh->buildUniformGrid();
+
+		start = Clock::now();
+		int retraced = photons.shapeMoved(meshIndex);
+		photons.buildMaps(global, caustic);
+		double incremental = secondsSince(start);
+
+		start = Clock::now();
+		IncrementalPhotons full(&box.scene, emissions, emissions, seed);
+		full.traceAll();
+		full.buildMaps(fullGlobal, fullCaustic);
+		double fullSeconds = secondsSince(start);
+
+		bool identical = samePhotons(global, fullGlobal) && samePhotons(caustic, fullCaustic);
+		allIdentical = allIdentical && identical;
+		std::printf("%d,%d,%d,%.4f,%.4f,%.2f,%s\n", frame, retraced, paths, incremental, fullSeconds,
+			fullSeconds / std::max(incremental, 1e-9), identical ? "true" : "false");
+	}
+	return allIdentical ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+// Timings of the hot kernels over fixed seeds, written as JSON so runs of different versions
+// can be compared. Every kernel reports the best of a few repeats and a checksum of its
+// results, which should only change when the kernel's output does.
+// Built by the top-level CMakeLists.txt, run from the bench directory, e.g.
+//   cmake -S .. -B ../build && cmake --build ../build
+//   ../build/bench/kernelBench [../resources] [results.json]
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "scene.hpp"
+#include "camera.hpp"
+#include "parallelogram.hpp"
+#include "triangleMesh.hpp"
+#include "kdTree.hpp"
+#include "photonTracing.hpp"
+#include "photonMappingIntegrator.hpp"
+#include "cornellBox.hpp"
+
+struct BenchResult
+{
+	std::string kernel;
+	// JSON members describing the case, e.g. "\"mesh\": \"p.obj\""
+	std::string params;
+	long long ops;
+	double seconds;
+	double checksum;
+};
+
+std::vector<BenchResult> results;
+
+// time @run, best of @repeats, with @setup run untimed before every repeat
+// @run returns a checksum of what it computed, which also keeps the work from being optimized out
+template <class Setup, class Run>
+void measure(const std::string& kernel, const std::string& params, long long ops, int repeats, Setup setup, Run run)
+{
+	BenchResult result{ kernel, params, ops, 0.0, 0.0 };
+	for (int r = 0; r < repeats; r++)
+	{
+		setup();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		result.checksum = run();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.seconds = r == 0 ? seconds : std::min(result.seconds, seconds);
+	}
+	std::cerr << kernel << " {" << params << "}: " << result.seconds * 1e9 / ops << " ns/op" << std::endl;
+	results.push_back(result);
+}
+
+template <class Run>
+void measure(const std::string& kernel, const std::string& params, long long ops, int repeats, Run run)
+{
+	measure(kernel, params, ops, repeats, []() {}, run);
+}
+
+Eigen::Vector3f randomUnitVector(Sampler& sampler)
+{
+	float z = 1 - 2 * sampler.nextFloat();
+	float phi = 2 * M_PIf * sampler.nextFloat();
+	float r = std::sqrt(std::max(0.0f, 1 - z * z));
+	return Eigen::Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// rays from a sphere around @box towards random points inside it
+std::vector<Ray> raysTowards(const AABB& box, int count, uint64_t seed)
+{
+	Sampler sampler(seed);
+	Eigen::Vector3f center = (box.lb + box.ub) / 2;
+	float radius = (box.ub - box.lb).norm();
+	std::vector<Ray> rays;
+	for (int i = 0; i < count; i++)
+	{
+		Eigen::Vector3f ori = center + radius * randomUnitVector(sampler);
+		Eigen::Vector3f target = box.lb + (box.ub - box.lb).cwiseProduct(
+			Eigen::Vector3f(sampler.nextFloat(), sampler.nextFloat(), sampler.nextFloat()));
+		rays.emplace_back(ori, (target - ori).normalized());
+	}
+	return rays;
+}
+
+// bounding box test then mesh test, as Scene::intersection runs them
+double intersectMesh(TriangleMesh& mesh, const std::vector<Ray>& rays)
+{
+	double checksum = 0;
+	for (const Ray& ray : rays)
+	{
+		Interaction interaction;
+		if (mesh.m_BoundingBox.rayIntersection(ray, interaction.entryDist, interaction.exitDist)
+			&& mesh.rayIntersection(interaction, ray))
+			checksum += interaction.entryDist;
+	}
+	return checksum;
+}
+
+void benchIntersection(const std::string& resources)
+{
+	std::vector<Ray> wallRays = raysTowards(AABB(Eigen::Vector3f(-10, -10, -10), Eigen::Vector3f(10, 10, -10)), 1000000, 1);
+	Parallelogram wall(Eigen::Vector3f(-10, -10, -10), Eigen::Vector3f(20, 0, 0), Eigen::Vector3f(0, 20, 0), Eigen::Vector3f(0, 0, 1), Eigen::Vector3f(1, 1, 1));
+	measure("Parallelogram::rayIntersection", "", (long long)wallRays.size(), 3, [&]() {
+		double checksum = 0;
+		for (const Ray& ray : wallRays)
+		{
+			Interaction interaction;
+			if (wall.rayIntersection(interaction, ray))
+				checksum += interaction.entryDist;
+		}
+		return checksum;
+	});
+
+	for (const char* name : { "p.obj", "sphere.obj" })
+	{
+		TriangleMesh mesh(Eigen::Vector3f(1, 1, 1), resources + "/" + name);
+		std::vector<Ray> rays = raysTowards(mesh.m_BoundingBox, 200000, 2);
+		std::string params = std::string("\"mesh\": \"") + name + "\", \"triangles\": " + std::to_string(mesh.triangleCount);
+
+		measure("AABB::rayIntersection", params, (long long)rays.size(), 3, [&]() {
+			double checksum = 0;
+			for (const Ray& ray : rays)
+			{
+				float tMin, tMax;
+				if (mesh.m_BoundingBox.rayIntersection(ray, tMin, tMax))
+					checksum += tMin;
+			}
+			return checksum;
+		});
+
+		// brute force tests every triangle, so it gets fewer rays
+		std::vector<Ray> bruteRays(rays.begin(), rays.begin() + 2000);
+		measure("TriangleMesh::rayIntersection", params + ", \"grid\": false", (long long)bruteRays.size(), 3,
+			[&]() { return intersectMesh(mesh, bruteRays); });
+
+		mesh.buildUniformGrid();
+		measure("TriangleMesh::rayIntersection", params + ", \"grid\": true", (long long)rays.size(), 3,
+			[&]() { return intersectMesh(mesh, rays); });
+	}
+}
+
+// photons uniformly in the unit cube
+void fillMap(Map& map, int count, uint64_t seed)
+{
+	Sampler sampler(seed);
+	for (int i = 0; i < count; i++)
+	{
+		Eigen::Vector3f pos(sampler.nextFloat(), sampler.nextFloat(), sampler.nextFloat());
+		map.store(pos, randomUnitVector(sampler), Eigen::Vector3f(1, 1, 1));
+	}
+}
+
+void benchPhotonMap()
+{
+	for (int count : { 10000, 100000, 1000000 })
+	{
+		std::string params = "\"photons\": " + std::to_string(count);
+		std::unique_ptr<Map> map;
+		measure("Map::balance", params, count, 3,
+			[&]() { map.reset(new Map(count, Eigen::Vector3f(1, 1, 1))); fillMap(*map, count, 3); },
+			[&]() { map->balance(); return (double)map->photons[1].pos.sum(); });
+
+		Sampler sampler(4);
+		std::vector<Eigen::Vector3f> queries(20000);
+		for (Eigen::Vector3f& q : queries)
+			q = Eigen::Vector3f(sampler.nextFloat(), sampler.nextFloat(), sampler.nextFloat());
+		for (int k : { 10, 50, 200 })
+		{
+			measure("Map::locate_photons", params + ", \"k\": " + std::to_string(k), (long long)queries.size(), 3, [&]() {
+				double checksum = 0;
+				for (const Eigen::Vector3f& q : queries)
+				{
+					Nearest_photons np(k, q, 1.0f);
+					map->locate_photons(&np);
+					checksum += np.curr_num > 0 ? np.dist[0] : 0.0f;
+				}
+				return checksum;
+			});
+		}
+	}
+}
+
+void benchPhotonsAndRender(const std::string& resources)
+{
+	CornellBox box(resources + "/p.obj");
+	const int emissions = 1000000;
+	measure("emitPhoton", "", emissions, 3, [&]() { threadSampler().setSeed(5); }, [&]() {
+		double checksum = 0;
+		for (int i = 0; i < emissions; i++)
+		{
+			Eigen::Vector3f ori, dir, power;
+			if (emitPhoton(&box.scene, ori, dir, power))
+				checksum += dir.y();
+		}
+		return checksum;
+	});
+
+	std::unique_ptr<Map> global, caustic;
+	measure("globalPhotonTracing", "\"emitted\": 10000", 10000, 3,
+		[&]() { threadSampler().setSeed(6); global.reset(new Map(100000, Eigen::Vector3f(1, 1, 1))); },
+		[&]() { return (double)globalPhotonTracing(&box.scene, *global, 10000); });
+	measure("causticsPhotonTracing", "\"stored\": 10000", 10000, 3,
+		[&]() { threadSampler().setSeed(7); caustic.reset(new Map(100000, Eigen::Vector3f(1, 1, 1))); },
+		[&]() { return (double)causticsPhotonTracing(&box.scene, *caustic, 10000); });
+	global->scale_photon_power(1.0f / global->emitted_photons);
+	caustic->scale_photon_power(1.0f / caustic->emitted_photons);
+	global->balance();
+	caustic->balance();
+
+	const int res = 128, samples = 16;
+	std::unique_ptr<Camera> camera;
+	measure("PhotonMappingIntegrator::render", "\"resolution\": " + std::to_string(res) + ", \"samples\": " + std::to_string(samples),
+		(long long)res * res * samples, 1,
+		[&]() {
+			threadSampler().setSeed(8);
+			camera = box.newCamera(res);
+		},
+		[&]() {
+			PhotonMappingIntegrator integrator(&box.scene, camera.get());
+			integrator.samples = samples;
+			integrator.render(*global, *caustic);
+			double checksum = 0;
+			for (const Eigen::Vector3f& pixel : camera->m_Film.pixelSamples)
+				checksum += pixel.sum();
+			return checksum;
+		});
+}
+
+bool writeJSON(std::ostream& out)
+{
+	out << "{\n  \"threads\": " << std::thread::hardware_concurrency() << ",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		char numbers[160];
+		std::snprintf(numbers, sizeof(numbers), "\"ops\": %lld, \"seconds\": %.6g, \"nsPerOp\": %.6g, \"checksum\": %.17g",
+			r.ops, r.seconds, r.seconds * 1e9 / r.ops, r.checksum);
+		out << "    { \"kernel\": \"" << r.kernel << "\", " << (r.params.empty() ? "" : r.params + ", ") << numbers << " }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+	return (bool)out;
+}
+
+int main(int argc, char** argv)
+{
+	std::string resources = argc > 1 ? argv[1] : "../resources";
+	benchIntersection(resources);
+	benchPhotonMap();
+	benchPhotonsAndRender(resources);
+	if (argc > 2)
+	{
+		std::ofstream out(argv[2]);
+		if (!writeJSON(out))
+		{
+			std::cerr << "cannot write " << argv[2] << std::endl;
+			return 1;
+		}
+	}
+	else
+		writeJSON(std::cout);
+	return 0;
+}
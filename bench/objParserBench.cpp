@@ -0,0 +1,93 @@
+// Throughput of the OBJ parser on resources/sphere.obj and on larger generated meshes.
+// Built by the top-level CMakeLists.txt, run from the bench directory, e.g.
+//   cmake -S .. -B ../build && cmake --build ../build
+//   ../build/bench/objParserBench [../resources/sphere.obj] [largest generated size in MB, default 256]
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include "objloader.hpp"
+
+// Write a UV sphere of about @targetBytes as OBJ. Faces alternate between quads with
+// v/vt/vn corners, triangles with v//vn corners and quads with negative indices.
+std::string writeSphere(const std::string& path, size_t targetBytes)
+{
+	// about 165 bytes of text per grid vertex
+	int n = std::max(8, (int)std::sqrt((double)targetBytes / 165.0));
+	std::ofstream out(path);
+	char line[160];
+	for (int i = 0; i <= n; i++)
+	{
+		for (int j = 0; j <= n; j++)
+		{
+			float theta = M_PIf * i / n, phi = 2.0f * M_PIf * j / n;
+			float x = std::sin(theta) * std::cos(phi), y = std::cos(theta), z = std::sin(theta) * std::sin(phi);
+			std::snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn %.6f %.6f %.6f\n", x, y, z, (float)j / n, (float)i / n, x, y, z);
+			out << line;
+		}
+	}
+	int count = (n + 1) * (n + 1);
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			int a = i * (n + 1) + j + 1, b = a + 1, c = a + n + 1, d = c + 1;
+			switch ((i + j) % 3)
+			{
+			case 0:
+				std::snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, d, d, d, c, c, c);
+				break;
+			case 1:
+				std::snprintf(line, sizeof(line), "f %d//%d %d//%d %d//%d\nf %d//%d %d//%d %d//%d\n", a, a, b, b, d, d, a, a, d, d, c, c);
+				break;
+			default:
+				a -= count + 1, b -= count + 1, c -= count + 1, d -= count + 1;
+				std::snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, d, d, d, c, c, c);
+				break;
+			}
+			out << line;
+		}
+	}
+	return path;
+}
+
+// best of @runs parses, in MB/s
+void bench(const std::string& path, int runs)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	double megabytes = (double)in.tellg() / (1 << 20);
+	double best = 1e30;
+	size_t triangles = 0;
+	for (int r = 0; r < runs; r++)
+	{
+		std::vector<Eigen::Vector3f> vertices, normals;
+		std::vector<Eigen::Vector2f> uvs;
+		std::vector<int> v, vt, vn;
+		auto start = std::chrono::steady_clock::now();
+		if (!loadOBJ_index(path.c_str(), vertices, uvs, normals, v, vt, vn))
+		{
+			std::cout << "failed to parse " << path << std::endl;
+			return;
+		}
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		triangles = v.size() / 3;
+	}
+	std::cout << path << ": " << megabytes << " MB, " << triangles << " triangles, " << best * 1000.0 << " ms, "
+		<< megabytes / best << " MB/s" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::string sphere = argc > 1 ? argv[1] : "../resources/sphere.obj";
+	size_t largest = (argc > 2 ? std::atoi(argv[2]) : 256) * ((size_t)1 << 20);
+	bench(sphere, 20);
+	for (size_t size = (size_t)1 << 24; size <= largest; size *= 4)
+	{
+		std::string path = writeSphere("generated_" + std::to_string(size >> 20) + "MB.obj", size);
+		bench(path, 3);
+		std::remove(path.c_str());
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+// Walker's alias table over a discrete distribution, built with Vose's method.
+// Every slot holds a probability and an alias, so picking an index costs one random number,
+// one multiply and one compare however many entries there are.
+class AliasTable
+{
+public:
+	// build from non-negative @weights, return false if they sum to zero
+	bool build(const std::vector<float>& weights)
+	{
+		int n = (int)weights.size();
+		prob.assign(n, 0.0f);
+		alias.assign(n, 0);
+		pmfs.assign(n, 0.0f);
+		double sum = 0.0;
+		for (float w : weights)
+			sum += std::max(w, 0.0f);
+		if (sum <= 0.0)
+		{
+			clear();
+			return false;
+		}
+
+		// scaled so that the average slot holds exactly 1
+		std::vector<double> scaled(n);
+		std::vector<int> small, large;
+		for (int i = 0; i < n; i++)
+		{
+			pmfs[i] = (float)(std::max(weights[i], 0.0f) / sum);
+			scaled[i] = std::max(weights[i], 0.0f) * n / sum;
+			(scaled[i] < 1.0 ? small : large).push_back(i);
+		}
+		while (!small.empty() && !large.empty())
+		{
+			int s = small.back(), l = large.back();
+			small.pop_back();
+			prob[s] = (float)scaled[s];
+			alias[s] = l;
+			scaled[l] -= 1.0 - scaled[s];
+			if (scaled[l] < 1.0)
+			{
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+		// what is left is 1 up to rounding
+		for (int i : large)
+		{
+			prob[i] = 1.0f;
+			alias[i] = i;
+		}
+		for (int i : small)
+		{
+			prob[i] = 1.0f;
+			alias[i] = i;
+		}
+		return true;
+	}
+
+	void clear()
+	{
+		prob.clear();
+		alias.clear();
+		pmfs.clear();
+	}
+
+	bool empty() const
+	{
+		return prob.empty();
+	}
+
+	int size() const
+	{
+		return (int)prob.size();
+	}
+
+	// pick an index with @u uniform in [0, 1), @pmf is its probability
+	int sample(float u, float& pmf) const
+	{
+		int n = (int)prob.size();
+		float scaled = u * n;
+		int i = std::min((int)scaled, n - 1);
+		if (scaled - i >= prob[i])
+			i = alias[i];
+		pmf = pmfs[i];
+		return i;
+	}
+
+	float pmf(int i) const
+	{
+		return pmfs[i];
+	}
+
+private:
+	std::vector<float> prob;
+	std::vector<int> alias;
+	std::vector<float> pmfs;
+};
@@ -30,7 +30,15 @@ public:
         Eigen::Array2f t(dx, dy);
         Eigen::Array2f r(m_Film.m_Res.x(), m_Film.m_Res.y());
         t = t / r * 2 - 1;
-        return {m_Pos, t.x() * m_Right + t.y() * m_Up + m_Forward};
+        Ray ray(m_Pos, t.x() * m_Right + t.y() * m_Up + m_Forward);
+        ray.m_Spread = pixelSpread();
+        return ray;
+    }
+
+    // width of one pixel at unit distance from the camera
+    float pixelSpread() const
+    {
+        return 2.0f * m_Up.norm() / m_Film.m_Res.y();
     }
 
     void setPixel(int dx, int dy, Eigen::Vector3f value)
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include "Eigen/Dense"
+#include "camera.hpp"
+#include "scene.hpp"
+#include "kdTree.hpp"
+#include "tileScheduler.hpp"
+#include "photonMappingIntegrator.hpp"
+
+// Batch rendering of several views of one scene. Photon maps do not depend on the camera,
+// so they are traced and balanced once and every view gathers from the same read-only maps.
+
+struct CameraPose
+{
+	Eigen::Vector3f position;
+	Eigen::Vector3f lookAt;
+	Eigen::Vector3f up;
+	// vertical field of view in degrees
+	float verticalFov;
+};
+
+// Read camera poses from a text file, one per line: position, look-at point and up vector,
+// three numbers each, then the vertical field of view. Blank lines and lines starting with
+// # are skipped. Return false if the file cannot be read or a line is malformed.
+bool readCameraPoses(const std::string& path, std::vector<CameraPose>& poses)
+{
+	FILE* file = std::fopen(path.c_str(), "r");
+	if (file == nullptr)
+		return false;
+	bool ok = true;
+	char line[512];
+	while (ok && std::fgets(line, sizeof(line), file) != nullptr)
+	{
+		const char* p = line;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+			continue;
+		CameraPose pose;
+		ok = std::sscanf(p, "%f %f %f %f %f %f %f %f %f %f",
+			&pose.position.x(), &pose.position.y(), &pose.position.z(),
+			&pose.lookAt.x(), &pose.lookAt.y(), &pose.lookAt.z(),
+			&pose.up.x(), &pose.up.y(), &pose.up.z(), &pose.verticalFov) == 10;
+		if (ok)
+			poses.push_back(pose);
+	}
+	std::fclose(file);
+	return ok;
+}
+
+// @count poses evenly spaced on a circle of @radius around @center, @height above it along
+// @up, all looking at @center, as for a turntable
+std::vector<CameraPose> orbitPoses(const Eigen::Vector3f& center, const Eigen::Vector3f& up, float radius, float height, int count, float verticalFov)
+{
+	Eigen::Vector3f axis = up.normalized();
+	Eigen::Vector3f u = (std::fabs(axis.x()) > 0.1f ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(1, 0, 0)).cross(axis).normalized();
+	Eigen::Vector3f v = axis.cross(u);
+	std::vector<CameraPose> poses;
+	for (int i = 0; i < count; i++)
+	{
+		float phi = 2.0f * M_PIf * i / count;
+		Eigen::Vector3f position = center + radius * (std::cos(phi) * u + std::sin(phi) * v) + height * axis;
+		poses.push_back({ position, center, up, verticalFov });
+	}
+	return poses;
+}
+
+// Render every pose at @res against the same photon maps.
+// Views run in parallel, each on its share of the @threadCount threads (0 for all hardware
+// threads), so a batch of many views keeps every thread on a view of its own instead of
+// synchronizing on the tiles of one image. @configure sets up the integrator of a view
+// before it renders, @finish gets the rendered view on the worker that rendered it, e.g.
+// to write it; both may run concurrently for different views.
+void renderViews(Scene& scene, const std::vector<CameraPose>& poses, const Eigen::Vector2i& res, PhotonMap& global, PhotonMap& caustic,
+	int threadCount, const std::function<void(PhotonMappingIntegrator&)>& configure,
+	const std::function<void(int, Camera&, PhotonMappingIntegrator&)>& finish)
+{
+	if (poses.empty())
+		return;
+	TileScheduler scheduler(threadCount);
+	int viewWorkers = std::min(scheduler.getWorkerCount(), (int)poses.size());
+	int threadsPerView = std::max(1, scheduler.getWorkerCount() / viewWorkers);
+	scheduler.run((int)poses.size(), [&](int view, int) {
+		const CameraPose& pose = poses[view];
+		Camera camera(pose.position, pose.lookAt, pose.up, pose.verticalFov, res);
+		PhotonMappingIntegrator integrator(&scene, &camera);
+		configure(integrator);
+		integrator.threadCount = threadsPerView;
+		integrator.render(global, caustic);
+		finish(view, camera, integrator);
+	});
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "Eigen/Dense"
+#include "film.hpp"
+#include "gBuffer.hpp"
+#include "tileScheduler.hpp"
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010).
+// Every iteration blurs with a 5x5 B3-spline kernel whose taps are spread 2^i pixels apart,
+// each tap weighted down by how much its color, normal, depth and albedo differ from the
+// center pixel, so noise is smoothed without crossing edges. The albedo is divided out
+// before filtering and multiplied back after, so textures and wall colors stay sharp.
+// The cost only depends on the resolution and the iteration count.
+class Denoiser
+{
+public:
+	// number of wavelet levels, the filter covers about 2^(iterations+2) pixels
+	int iterations = 5;
+	// edge stopping widths: color (halved every iteration), normal (1 - cosine),
+	// depth (relative to the center depth) and albedo
+	float sigmaColor = 1.0f;
+	float sigmaNormal = 0.1f;
+	float sigmaDepth = 0.05f;
+	float sigmaAlbedo = 0.1f;
+	// number of worker threads, 0 uses all hardware threads
+	int threadCount = 0;
+
+	// filter @film in place, guided by the first hits in @gBuffer
+	void denoise(Film& film, const GBuffer& gBuffer)
+	{
+		width = film.m_Res.x();
+		height = film.m_Res.y();
+		int pixelCount = width * height;
+		for (int c = 0; c < 3; c++)
+		{
+			color[c].resize(pixelCount);
+			filtered[c].resize(pixelCount);
+			albedo[c].resize(pixelCount);
+			normal[c].resize(pixelCount);
+		}
+		depth.resize(pixelCount);
+		invDepth.resize(pixelCount);
+
+		// split the film and G-buffer into planes, one float per pixel, so the filter loops
+		// run over contiguous memory and vectorize
+		for (int idx = 0; idx < pixelCount; idx++)
+		{
+			const Interaction& hit = gBuffer.hits[idx];
+			bool isHit = hit.material != NULL;
+			Eigen::Vector3f n = isHit ? hit.normal.normalized() : Eigen::Vector3f::Zero();
+			for (int c = 0; c < 3; c++)
+			{
+				// channels the surface does not reflect are filtered as they are
+				float a = isHit && hit.surfaceColor[c] > 1e-3f ? hit.surfaceColor[c] : 1.0f;
+				albedo[c][idx] = a;
+				color[c][idx] = film.pixelSamples[idx][c] / a;
+				normal[c][idx] = n[c];
+			}
+			depth[idx] = isHit ? hit.entryDist : 1e10f;
+			invDepth[idx] = 1.0f / std::max(depth[idx], 1e-3f);
+		}
+
+		TileScheduler scheduler(threadCount);
+		const int rowsPerJob = 8;
+		for (int i = 0; i < iterations; i++)
+		{
+			int step = 1 << i;
+			float colorWidth = sigmaColor / (float)step;
+			scheduler.run((height + rowsPerJob - 1) / rowsPerJob, [&](int job, int) {
+				for (int y = job * rowsPerJob; y < std::min(height, (job + 1) * rowsPerJob); y++)
+					filterRow(y, step, colorWidth);
+			});
+			for (int c = 0; c < 3; c++)
+				color[c].swap(filtered[c]);
+		}
+
+		for (int idx = 0; idx < pixelCount; idx++)
+			for (int c = 0; c < 3; c++)
+				film.pixelSamples[idx][c] = color[c][idx] * albedo[c][idx];
+	}
+
+private:
+	// e^x for x <= 0, without branches or library calls so the loops calling it vectorize:
+	// x = n ln2 + r with |r| <= ln2/2, e^r from its Taylor polynomial and 2^n written into the
+	// exponent bits. Relative error below 2e-7. Inputs under -60 give e^-60, which is nothing
+	// next to the center tap but keeps the weighted sums clear of slow denormal floats.
+	static float expNegative(float x)
+	{
+		// max(x, -60) without a compare, which would keep the loop from vectorizing
+		x = 0.5f * (x - 60.0f + std::fabs(x + 60.0f));
+		// truncation rounds the negative value up, so n is x / ln2 rounded to the nearest
+		int n = (int)(x * 1.44269504f - 0.5f);
+		float r = x - (float)n * 0.693147181f;
+		float p = 1.0f / 720.0f;
+		p = p * r + 1.0f / 120.0f;
+		p = p * r + 1.0f / 24.0f;
+		p = p * r + 1.0f / 6.0f;
+		p = p * r + 0.5f;
+		p = p * r + 1.0f;
+		p = p * r + 1.0f;
+		int32_t bits = (n + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		return p * scale;
+	}
+
+	// one a-trous level of row @y from color into filtered
+	// The row is summed in blocks on the stack: no allocation per row, and the compiler can
+	// tell the sums apart from the planes, so the tap loop vectorizes without alias checks.
+	void filterRow(int y, int step, float colorWidth)
+	{
+		static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+		enum { block = 64 };
+		float invColor = 1.0f / (colorWidth * colorWidth);
+		float invNormal = 1.0f / sigmaNormal;
+		float invDepthWidth = 1.0f / (sigmaDepth * (float)step);
+		float invAlbedo = 1.0f / (sigmaAlbedo * sigmaAlbedo);
+		const float* c0 = color[0].data();
+		const float* c1 = color[1].data();
+		const float* c2 = color[2].data();
+		const float* n0 = normal[0].data();
+		const float* n1 = normal[1].data();
+		const float* n2 = normal[2].data();
+		const float* a0 = albedo[0].data();
+		const float* a1 = albedo[1].data();
+		const float* a2 = albedo[2].data();
+		const float* z = depth.data();
+		const float* iz = invDepth.data();
+
+		const int row = y * width;
+		for (int x0 = 0; x0 < width; x0 += block)
+		{
+			int x1 = std::min(width, x0 + block);
+			float sum[3][block] = {}, weight[block] = {};
+			for (int ky = -2; ky <= 2; ky++)
+			{
+				int qy = y + ky * step;
+				if (qy < 0 || qy >= height)
+					continue;
+				for (int kx = -2; kx <= 2; kx++)
+				{
+					// taps falling off the image are left out, the sum of weights renormalizes
+					int dx = kx * step;
+					int begin = std::max(x0, -dx), end = std::min(x1, width - dx);
+					const int tap = qy * width + dx;
+					const float h = kernel[ky + 2] * kernel[kx + 2];
+					for (int x = begin; x < end; x++)
+					{
+						int p = row + x, q = tap + x, i = x - x0;
+						float dr = c0[q] - c0[p], dg = c1[q] - c1[p], db = c2[q] - c2[p];
+						float dn = 1.0f - (n0[q] * n0[p] + n1[q] * n1[p] + n2[q] * n2[p]);
+						float dz = std::fabs(z[q] - z[p]) * iz[p];
+						float ar = a0[q] - a0[p], ag = a1[q] - a1[p], ab = a2[q] - a2[p];
+						// max(dn, 0) without a compare
+						float w = h * expNegative(-(dr * dr + dg * dg + db * db) * invColor - 0.5f * (dn + std::fabs(dn)) * invNormal
+							- dz * invDepthWidth - (ar * ar + ag * ag + ab * ab) * invAlbedo);
+						sum[0][i] += w * c0[q];
+						sum[1][i] += w * c1[q];
+						sum[2][i] += w * c2[q];
+						weight[i] += w;
+					}
+				}
+			}
+			// the center tap always has weight h > 0
+			for (int c = 0; c < 3; c++)
+				for (int x = x0; x < x1; x++)
+					filtered[c][row + x] = sum[c][x - x0] / weight[x - x0];
+		}
+	}
+
+	int width = 0, height = 0;
+	// planar buffers: demodulated color, filter output, albedo, normal, depth and its inverse
+	std::vector<float> color[3], filtered[3], albedo[3], normal[3];
+	std::vector<float> depth, invDepth;
+};
@@ -7,13 +7,27 @@ class Film {
 public:
     Film(const Eigen::Vector2i& res) {
         m_Res = res;
-        pixelSamples.resize(m_Res.x() * m_Res.y(), Eigen::Vector3f(1, 1, 1));
+        pixelSamples.resize(m_Res.x() * m_Res.y(), Eigen::Vector3f::Zero());
+        accumulation.resize(m_Res.x() * m_Res.y(), Eigen::Vector3f::Zero());
+        sampleCounts.resize(m_Res.x() * m_Res.y(), 0);
     }
 
 	float getAspectRatio() {
         return static_cast<float>(m_Res.x()) / m_Res.y();
     }
 
+    // store the @sum of @count samples of a pixel, pixelSamples gets their mean
+    void setAccumulated(int dx, int dy, const Eigen::Vector3f& sum, int count) {
+        int idx = dy * m_Res.x() + dx;
+        accumulation[idx] = sum;
+        sampleCounts[idx] = count;
+        pixelSamples[idx] = count > 0 ? Eigen::Vector3f(sum / (float)count) : Eigen::Vector3f::Zero();
+    }
+
     Eigen::Vector2i m_Res;
+    // linear HDR value of every pixel, the image that gets written out
     std::vector<Eigen::Vector3f> pixelSamples;
+    // sum of the samples of every pixel and how many there are, so films can be merged or re-weighted
+    std::vector<Eigen::Vector3f> accumulation;
+    std::vector<int> sampleCounts;
 };
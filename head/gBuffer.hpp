@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include "Eigen/Dense"
+#include "interaction.hpp"
+
+// First camera hit of every pixel.
+// Built once by the visibility pass and read by every shading pass, so the primary ray
+// of a pixel is traversed once instead of once per pass and per sample.
+// A pixel whose ray escapes keeps material == NULL, lightId still tells if it saw a light.
+class GBuffer {
+public:
+    GBuffer() : m_Res(0, 0) {}
+
+    void resize(const Eigen::Vector2i& res) {
+        m_Res = res;
+        hits.assign(m_Res.x() * m_Res.y(), Interaction());
+    }
+
+    Interaction& at(int dx, int dy) {
+        return hits[dy * m_Res.x() + dx];
+    }
+
+    const Interaction& at(int dx, int dy) const {
+        return hits[dy * m_Res.x() + dx];
+    }
+
+    bool isHit(int dx, int dy) const {
+        return at(dx, dy).material != NULL;
+    }
+
+    Eigen::Vector2i m_Res;
+    // position, normal, color, material, depth (entryDist) and view direction (inputDir)
+    std::vector<Interaction> hits;
+};
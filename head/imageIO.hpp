@@ -0,0 +1,215 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "Eigen/Dense"
+#include "film.hpp"
+#include "tileScheduler.hpp"
+
+// Writers for the film: 8-bit sRGB for display, and lossless float PFM and OpenEXR so the
+// HDR image can be re-exposed and graded without rendering again.
+// Film row 0 is the bottom of the image. Float files are written little endian.
+
+// Linear to 8-bit sRGB through a table over [0, 1], fine enough that the steepest part of
+// the curve near black stays within one code of the exact value
+class SRGBEncoder
+{
+public:
+	static const int tableSize = 4096;
+
+	SRGBEncoder()
+	{
+		for (int i = 0; i <= tableSize; i++)
+		{
+			float x = (float)i / tableSize;
+			float y = x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f;
+			table[i] = (unsigned char)(y * 255.0f + 0.5f);
+		}
+	}
+
+	// encode @count floats, written so the clamp and the index math vectorize
+	void encode(const float* src, unsigned char* dst, int count) const
+	{
+		for (int i = 0; i < count; i++)
+		{
+			float x = std::min(std::max(src[i], 0.0f), 1.0f);
+			dst[i] = table[(int)(x * tableSize + 0.5f)];
+		}
+	}
+
+private:
+	unsigned char table[tableSize + 1];
+};
+
+// 8-bit sRGB pixels of @film, top row first, rows converted in parallel
+std::vector<unsigned char> filmToSRGB8(const Film& film, int threadCount = 0)
+{
+	static const SRGBEncoder encoder;
+	int width = film.m_Res.x(), height = film.m_Res.y();
+	std::vector<unsigned char> data(width * height * 3);
+	TileScheduler scheduler(threadCount);
+	scheduler.run(height, [&](int y, int) {
+		const float* src = film.pixelSamples[(height - 1 - y) * width].data();
+		encoder.encode(src, &data[y * width * 3], width * 3);
+	});
+	return data;
+}
+
+// Portable float map, three channels, bottom row first
+bool writePFM(const std::string& path, const Film& film)
+{
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	std::fprintf(file, "PF\n%d %d\n-1.0\n", film.m_Res.x(), film.m_Res.y());
+	for (const Eigen::Vector3f& v : film.pixelSamples)
+		std::fwrite(v.data(), sizeof(float), 3, file);
+	return std::fclose(file) == 0;
+}
+
+// Read a PFM as writePFM writes it into @film, which must have the same resolution
+bool readPFM(const std::string& path, Film& film)
+{
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+	char type[3] = {};
+	int width = 0, height = 0;
+	float scale = 0.0f;
+	bool ok = std::fscanf(file, "%2s %d %d %f", type, &width, &height, &scale) == 4 && std::string(type) == "PF"
+		&& width == film.m_Res.x() && height == film.m_Res.y() && scale < 0.0f && std::fgetc(file) == '\n';
+	Eigen::Vector3f v;
+	for (int idx = 0; ok && idx < width * height; idx++)
+	{
+		ok = std::fread(v.data(), sizeof(float), 3, file) == 3;
+		film.setAccumulated(idx % width, idx / width, v, 1);
+	}
+	std::fclose(file);
+	return ok;
+}
+
+// Scanline OpenEXR with uncompressed 32-bit float R, G and B channels
+bool writeEXR(const std::string& path, const Film& film)
+{
+	int width = film.m_Res.x(), height = film.m_Res.y();
+	std::vector<unsigned char> header;
+	auto put = [&](const void* p, size_t n) { header.insert(header.end(), (const unsigned char*)p, (const unsigned char*)p + n); };
+	auto putInt = [&](int32_t v) { put(&v, 4); };
+	auto putFloat = [&](float v) { put(&v, 4); };
+	auto putString = [&](const char* s) { put(s, std::strlen(s) + 1); };
+	auto attribute = [&](const char* name, const char* type, int size) { putString(name); putString(type); putInt(size); };
+
+	const unsigned char magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+	put(magic, 8);
+	// channels are stored in alphabetical order
+	const char* channels[3] = { "B", "G", "R" };
+	attribute("channels", "chlist", 3 * (2 + 16) + 1);
+	for (const char* c : channels)
+	{
+		putString(c);
+		putInt(2);	// FLOAT
+		putInt(0);	// pLinear and reserved
+		putInt(1);	// x and y sampling
+		putInt(1);
+	}
+	header.push_back(0);
+	attribute("compression", "compression", 1);
+	header.push_back(0);	// NO_COMPRESSION
+	attribute("dataWindow", "box2i", 16);
+	putInt(0); putInt(0); putInt(width - 1); putInt(height - 1);
+	attribute("displayWindow", "box2i", 16);
+	putInt(0); putInt(0); putInt(width - 1); putInt(height - 1);
+	attribute("lineOrder", "lineOrder", 1);
+	header.push_back(0);	// INCREASING_Y
+	attribute("pixelAspectRatio", "float", 4);
+	putFloat(1.0f);
+	attribute("screenWindowCenter", "v2f", 8);
+	putFloat(0.0f); putFloat(0.0f);
+	attribute("screenWindowWidth", "float", 4);
+	putFloat(1.0f);
+	header.push_back(0);
+
+	// one scanline per block: y, byte count, then every channel's row
+	int32_t lineBytes = width * 3 * 4;
+	uint64_t offset = header.size() + 8 * (uint64_t)height;
+	for (int y = 0; y < height; y++)
+	{
+		uint64_t lineOffset = offset + (uint64_t)y * (8 + lineBytes);
+		put(&lineOffset, 8);
+	}
+
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	std::fwrite(header.data(), 1, header.size(), file);
+	std::vector<float> line(width * 3);
+	for (int32_t y = 0; y < height; y++)
+	{
+		const Eigen::Vector3f* row = &film.pixelSamples[(height - 1 - y) * width];
+		for (int x = 0; x < width; x++)
+			for (int c = 0; c < 3; c++)
+				line[c * width + x] = row[x][2 - c];
+		std::fwrite(&y, 4, 1, file);
+		std::fwrite(&lineBytes, 4, 1, file);
+		std::fwrite(line.data(), 4, line.size(), file);
+	}
+	return std::fclose(file) == 0;
+}
+
+// Partial film of a distributed render: the resolution, then the sample sum and count of
+// every pixel this process rendered. Partial films of the same frame are merged by adding
+// sums and counts, so tiles may also be rendered more than once to add samples.
+bool writePartialFilm(const std::string& path, const Film& film)
+{
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	const char magic[4] = { 'P', 'F', 'L', 'M' };
+	std::fwrite(magic, 1, 4, file);
+	std::fwrite(film.m_Res.data(), sizeof(int), 2, file);
+	for (int32_t idx = 0; idx < (int32_t)film.sampleCounts.size(); idx++)
+	{
+		if (film.sampleCounts[idx] == 0)
+			continue;
+		std::fwrite(&idx, sizeof(int32_t), 1, file);
+		std::fwrite(film.accumulation[idx].data(), sizeof(float), 3, file);
+		std::fwrite(&film.sampleCounts[idx], sizeof(int), 1, file);
+	}
+	return std::fclose(file) == 0;
+}
+
+// Add the pixels of a partial film to @film, which must have the same resolution
+bool mergePartialFilm(const std::string& path, Film& film)
+{
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+	char magic[4];
+	Eigen::Vector2i res;
+	if (std::fread(magic, 1, 4, file) != 4 || std::string(magic, 4) != "PFLM"
+		|| std::fread(res.data(), sizeof(int), 2, file) != 2 || res != film.m_Res)
+	{
+		std::fclose(file);
+		return false;
+	}
+	int32_t idx;
+	Eigen::Vector3f sum;
+	int count;
+	bool ok = true;
+	while (std::fread(&idx, sizeof(int32_t), 1, file) == 1)
+	{
+		if (std::fread(sum.data(), sizeof(float), 3, file) != 3 || std::fread(&count, sizeof(int), 1, file) != 1
+			|| idx < 0 || idx >= (int32_t)film.sampleCounts.size())
+		{
+			ok = false;
+			break;
+		}
+		film.setAccumulated(idx % film.m_Res.x(), idx / film.m_Res.x(), film.accumulation[idx] + sum, film.sampleCounts[idx] + count);
+	}
+	std::fclose(file);
+	return ok;
+}
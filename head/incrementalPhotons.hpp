@@ -0,0 +1,133 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include "Eigen/Dense"
+#include "scene.hpp"
+#include "kdTree.hpp"
+#include "photonTracing.hpp"
+#include "tileScheduler.hpp"
+
+// Photon maps that follow moving shapes without tracing every photon again.
+// Every emission is traced from its own random stream, as the sharded tracers do, and its
+// path is recorded: its rays, a mask of the shapes whose bounds those rays entered, and the
+// photons it stored. When a shape moves, only the paths that entered its old bounds (the
+// mask) or whose rays enter its new bounds are traced again. A path traced again draws the
+// same random numbers as before, so the maps end up as a full trace from the same seed
+// would leave them, at a cost proportional to the paths the move touches. Caustic photons
+// are aimed at the specular shapes, so moving one of those traces every caustic path again.
+class IncrementalPhotons
+{
+public:
+	// number of worker threads, 0 uses all hardware threads
+	int threadCount = 0;
+
+	IncrementalPhotons(Scene* scene, int globalEmissions, int causticEmissions, uint64_t seed)
+		: scene(scene), seed(seed), globalPaths(globalEmissions), causticPaths(causticEmissions)
+	{
+	}
+
+	// trace every path, return the number of paths traced
+	int traceAll()
+	{
+		std::vector<int> global(globalPaths.size()), caustic(causticPaths.size());
+		for (int i = 0; i < (int)global.size(); i++)
+			global[i] = i;
+		for (int i = 0; i < (int)caustic.size(); i++)
+			caustic[i] = i;
+		targets.reset(new CausticTargets(scene));
+		trace(global, caustic);
+		return (int)(global.size() + caustic.size());
+	}
+
+	// trace the paths again that shape @shape (its index in the scene) may have changed,
+	// call once it has moved and its bounding box is up to date
+	// return the number of paths traced again
+	int shapeMoved(int shape)
+	{
+		const AABB& bounds = scene->shapes[shape]->m_BoundingBox;
+		uint64_t bit = uint64_t(1) << (shape % 64);
+		std::vector<int> global, caustic;
+		for (int i = 0; i < (int)globalPaths.size(); i++)
+			if ((globalPaths[i].shapeMask & bit) != 0 || crosses(globalPaths[i], bounds))
+				global.push_back(i);
+		bool specular = scene->shapes[shape]->material != nullptr && scene->shapes[shape]->material->isSpecular;
+		if (specular)
+			targets.reset(new CausticTargets(scene));
+		for (int i = 0; i < (int)causticPaths.size(); i++)
+			if (specular || (causticPaths[i].shapeMask & bit) != 0 || crosses(causticPaths[i], bounds))
+				caustic.push_back(i);
+		trace(global, caustic);
+		return (int)(global.size() + caustic.size());
+	}
+
+	// store the recorded photons in the maps, scale them by the emissions and balance
+	void buildMaps(Map& global, Map& caustic) const
+	{
+		fill(global, globalPaths);
+		fill(caustic, causticPaths);
+	}
+
+private:
+	void trace(const std::vector<int>& global, const std::vector<int>& caustic)
+	{
+		const int chunk = 256;
+		int globalJobs = ((int)global.size() + chunk - 1) / chunk;
+		int causticJobs = ((int)caustic.size() + chunk - 1) / chunk;
+		TileScheduler scheduler(threadCount);
+		scheduler.run(globalJobs + causticJobs, [&](int job, int) {
+			bool isCaustic = job >= globalJobs;
+			const std::vector<int>& paths = isCaustic ? caustic : global;
+			int begin = (isCaustic ? job - globalJobs : job) * chunk;
+			int end = std::min(begin + chunk, (int)paths.size());
+			for (int k = begin; k < end; k++)
+			{
+				int i = paths[k];
+				threadSampler().setSeed(seed, (uint64_t)i);
+				if (isCaustic)
+				{
+					causticPaths[i].clear();
+					if (!targets->empty())
+						traceCausticPhoton(scene, *targets, unused, &causticPaths[i]);
+				}
+				else
+				{
+					globalPaths[i].clear();
+					traceGlobalPhoton(scene, unused, &globalPaths[i]);
+				}
+			}
+		});
+	}
+
+	// whether a ray of @path enters @bounds before its end
+	static bool crosses(const PhotonPathRecord& path, AABB bounds)
+	{
+		for (const PhotonPathRecord::Segment& segment : path.segments)
+		{
+			float tMin, tMax;
+			Ray ray(segment.ori, segment.dir);
+			if (bounds.rayIntersection(ray, tMin, tMax) && tMin <= segment.length)
+				return true;
+		}
+		return false;
+	}
+
+	static void fill(Map& map, const std::vector<PhotonPathRecord>& paths)
+	{
+		map.clear();
+		for (const PhotonPathRecord& path : paths)
+			for (const Photon& p : path.photons)
+				map.store(p.pos, p.dir, p.power);
+		map.emitted_photons = (int)paths.size();
+		map.scale_photon_power(1.0f / std::max(map.emitted_photons, 1));
+		map.balance();
+	}
+
+	Scene* scene;
+	uint64_t seed;
+	std::vector<PhotonPathRecord> globalPaths, causticPaths;
+	std::unique_ptr<CausticTargets> targets;
+	// the tracers want a map, recorded paths never store into it
+	Map unused{ 0, Eigen::Vector3f(1, 1, 1) };
+};
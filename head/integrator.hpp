@@ -2,6 +2,7 @@
 #include "scene.hpp"
 #include "camera.hpp"
 #include "interaction.hpp"
+#include "kdTree.hpp"
 
 class Integrator
 {
@@ -12,6 +13,6 @@ public:
 	Integrator(Scene* scene, Camera* camera) : scene(scene), camera(camera) {}
 	virtual ~Integrator() = default;
 	
-	virtual void render() = 0;
+	virtual void render(PhotonMap& global, PhotonMap& caustic) = 0;
 	virtual Eigen::Vector3f radiance(Interaction* interaction, Ray* ray) = 0;
 };
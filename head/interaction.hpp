@@ -1,5 +1,37 @@
 #pragma once
+#include <cmath>
 #include "Eigen/Dense"
+
+// Orthonormal basis around a unit normal @n, without a branch on the direction of @n
+// (Duff et al., "Building an Orthonormal Basis, Revisited"). BSDFs work in this frame,
+// where the cosine to the normal is the z component.
+struct Frame
+{
+	Eigen::Vector3f s, t, n;
+
+	// identity until set from a normal
+	Frame() : s(1.0f, 0.0f, 0.0f), t(0.0f, 1.0f, 0.0f), n(0.0f, 0.0f, 1.0f) {}
+
+	explicit Frame(const Eigen::Vector3f& n) : n(n)
+	{
+		float sign = std::copysign(1.0f, n.z());
+		float a = -1.0f / (sign + n.z());
+		float b = n.x() * n.y() * a;
+		s = Eigen::Vector3f(1.0f + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+		t = Eigen::Vector3f(b, sign + n.y() * n.y() * a, -n.y());
+	}
+
+	Eigen::Vector3f toLocal(const Eigen::Vector3f& v) const
+	{
+		return Eigen::Vector3f(v.dot(s), v.dot(t), v.dot(n));
+	}
+
+	Eigen::Vector3f toWorld(const Eigen::Vector3f& v) const
+	{
+		return v.x() * s + v.y() * t + v.z() * n;
+	}
+};
+
 class Interaction
 {
 public:
@@ -10,17 +42,24 @@ public:
 	// distance (in units of t) to the second intersection point(if existed)
 	float exitDist;
 	// position of intersection point
-	Eigen::Vector3f entryPoint;
+	Eigen::Vector3f entryPoint = Eigen::Vector3f::Zero();
 	// normal of intersection point
-	Eigen::Vector3f normal;
+	Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+	// shading frame around the normal, set once per hit by Scene::intersection
+	Frame frame;
 	// barycentric coordinate of intersection point(if existed)
-	Eigen::Vector2f uv;
+	Eigen::Vector2f uv = Eigen::Vector2f::Zero();
+	// texture coordinates and uv units per unit of length at the hit, set for textured shapes
+	Eigen::Vector2f texCoord = Eigen::Vector2f::Zero();
+	float uvPerUnit = 0.0f;
+	// whether the shape set texCoord, a textured mesh without uvs does not
+	bool hasTexCoord = false;
 	// color of intersection point
-	Eigen::Vector3f surfaceColor;
+	Eigen::Vector3f surfaceColor = Eigen::Vector3f::Zero();
 	// wi input direction
-	Eigen::Vector3f inputDir;
+	Eigen::Vector3f inputDir = Eigen::Vector3f::Zero();
 	// w0 output direction
-	Eigen::Vector3f outputDir;
+	Eigen::Vector3f outputDir = Eigen::Vector3f::Zero();
 	// material of intersected object
 	void * material = NULL;
 	// light's ID if hit
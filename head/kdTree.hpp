@@ -1,11 +1,18 @@
 #pragma once
 // #include <omp.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstdio>
 #include "Eigen/Dense"
+#include "stats.hpp"
 
 class Photon {
 public:
     Eigen::Vector3f pos;                    // photon position
     Eigen::Vector3f dir;                    // incident direction
+    Eigen::Vector3f power;                  // flux carried by the photon
     int axis;                               // splitting axis
 public:
     Photon();                               // constructor
@@ -19,8 +26,9 @@ public:
     int curr_num;                           // number of nearest photons found
     bool built;                             // whether the heap has been built up
     Eigen::Vector3f pos;                    // position to search photons around
-    float* dist;                            // array of distance from a specific photon to the required position
+    float* dist;                            // array of squared distance from a specific photon to the required position
     Photon** photons;                       // array of photons found
+    std::vector<std::shared_ptr<const void>> pinned;                        // storage the found photons live in, if paged
 public:
     Nearest_photons(                        // constructor
         int n,
@@ -32,12 +40,36 @@ public:
     friend class Map;
 };
 
-class Map {
+class PhotonMap {
 public:
-    Photon* photons;                        // array of photons
     int stored_photons;                     // number of current photons
-    int max_photons;                        // photons capacity
+    int emitted_photons;                    // number of photons emitted from the lights to fill the map
     Eigen::Vector3f light_power;            // radiance of the light (to calculate photon power)
+public:
+    PhotonMap(                                                              // constructor
+        Eigen::Vector3f light_power);
+    virtual ~PhotonMap() = default;                                         // destructor
+    virtual void store(                                                     // call to store photons
+        const Eigen::Vector3f& pos,
+        const Eigen::Vector3f& dir,
+        const Eigen::Vector3f& power) = 0;
+    virtual void scale_photon_power(                                        // scale the power of all stored photons, usually by 1 / emitted_photons
+        float scale) = 0;
+    virtual void balance() = 0;                                             // call to make the stored photons searchable
+    virtual void locate(                                                    // k-nearest neighbor search over the whole map
+        Nearest_photons* np) = 0;
+    bool append(                                                            // store the photons and add the emitted count of a saved map, false if one does not fit
+        const std::string& path);
+    static bool read_counts(                                                // read the stored and emitted counts of a saved map
+        const std::string& path,
+        int& stored,
+        int& emitted);
+};
+
+class Map final : public PhotonMap {
+public:
+    Photon* photons;                        // array of photons
+    int max_photons;                        // photons capacity
     Eigen::Vector3f bbox_min;               // smallest coordinate of all photon position
     Eigen::Vector3f bbox_max;               // largest coordinate of all photon position
     void balance_segment(                   // balance the array (current root at root) from start to end
@@ -50,20 +82,33 @@ public:
     Map(                                                                    // constructor
         int max_photons,
         Eigen::Vector3f light_power);
-    ~Map();                                                                 // destructor
+    ~Map() override;                                                        // destructor
+    void clear();                                                           // forget every photon and emission, keep the capacity
+    void reserve(                                                           // grow the capacity to at least count photons, before balance
+        int count);
     void store(                                                             // call to store photons to photons array
         const Eigen::Vector3f& pos,
-        const Eigen::Vector3f& dir);
+        const Eigen::Vector3f& dir,
+        const Eigen::Vector3f& power) override;
+    void scale_photon_power(                                                // scale the power of all stored photons
+        float scale) override;
     static Eigen::Vector3f photon_dir(const Photon* p);                   // direction retriever
-    void balance();                                                         // call to build kd-tree from a flat array
+    void balance() override;                                                // call to build kd-tree from a flat array
     void locate_photons(                                                    // k-nearest neighbor algorithm
         Nearest_photons* np,
         int root = 1);
+    void locate(                                                            // k-nearest neighbor search from the root
+        Nearest_photons* np) override;
+    bool save(                                                              // write the photons and counts to a file, after balance
+        const std::string& path) const;
+    bool load(                                                              // replace the photons by those of a saved map
+        const std::string& path);
 };
 
 Photon::Photon() :
     pos(Eigen::Vector3f::Zero()),
     dir(Eigen::Vector3f::Zero()),
+    power(Eigen::Vector3f::Zero()),
     axis(-1) {}
 
 Nearest_photons::Nearest_photons(
@@ -88,12 +133,17 @@ Photon** Nearest_photons::get_photons() const {
     return photons;
 }
 
+PhotonMap::PhotonMap(
+    Eigen::Vector3f light_power) :
+    stored_photons(0),
+    emitted_photons(0),
+    light_power(std::move(light_power)) {}
+
 Map::Map(
     int max_photons,
     Eigen::Vector3f light_power) :
-    stored_photons(0),
-    max_photons(max_photons),
-    light_power(std::move(light_power)) {
+    PhotonMap(std::move(light_power)),
+    max_photons(max_photons) {
     photons = new Photon[max_photons + 1];
     for (int i = 0; i < 3; i++) {
         bbox_min[i] = std::numeric_limits<float>::max();
@@ -105,22 +155,55 @@ Map::~Map() {
     delete[] photons;
 }
 
+void Map::clear() {
+    delete[] photons;                                   // balance() shrinks the array to the stored photons
+    photons = new Photon[max_photons + 1];
+    stored_photons = 0;
+    emitted_photons = 0;
+    for (int i = 0; i < 3; i++) {
+        bbox_min[i] = std::numeric_limits<float>::max();
+        bbox_max[i] = -1 * std::numeric_limits<float>::max();
+    }
+}
+
+void Map::reserve(
+    int count) {
+    if (count <= max_photons)
+        return;
+    auto* grown = new Photon[count + 1];
+    std::copy(photons + 1, photons + stored_photons + 1, grown + 1);    // photons[0] is unused
+    delete[] photons;
+    photons = grown;
+    max_photons = count;
+}
+
 void Map::store(
     const Eigen::Vector3f& pos,
-    const Eigen::Vector3f& dir) {
-    if (stored_photons == max_photons)                  // array is already full
+    const Eigen::Vector3f& dir,
+    const Eigen::Vector3f& power) {
+    if (stored_photons == max_photons) {                // array is already full
+        STATS_INC(STAT_PHOTONS_DROPPED);
         return;
+    }
+    STATS_INC(STAT_PHOTONS_STORED);
 
     stored_photons++;                                  // add a new photon
     Photon* p = &photons[stored_photons];               // retrieve the back position
 
     p->pos = pos;                                       // set photon position
     p->dir = dir.normalized();                          // set incident direction
+    p->power = power;                                   // set photon power
 
     bbox_min = bbox_min.cwiseMin(pos);                  // enlarge the bounding box lower bound
     bbox_max = bbox_max.cwiseMax(pos);                  // enlarge the bounding box upper bound
 }
 
+void Map::scale_photon_power(
+    float scale) {
+    for (int i = 1; i <= stored_photons; i++)
+        photons[i].power *= scale;
+}
+
 Eigen::Vector3f Map::photon_dir(const Photon* p) {
     return p->dir;
 }
@@ -228,8 +311,11 @@ void Map::balance() {
 void Map::locate_photons(
     Nearest_photons* np,
     int root) {
+    if (root > stored_photons)                                                                              // missing right child of the last inner node
+        return;
+    STATS_INC(STAT_KNN_NODES);
     Photon* p = &photons[root];
-    if (root < stored_photons / 2 - 1) {                                                                        // if current node is not leaf node
+    if (2 * root <= stored_photons) {                                                                         // if current node is not leaf node
         float dist_to_bound = np->pos[p->axis] - p->pos[p->axis];                                           // calculate vertical distance to boundary
         if (dist_to_bound > 0.0f) {                                                                         // if position required is in the right half
             locate_photons(np, 2 * root + 1);                                                               // call for the right sub tree
@@ -245,7 +331,7 @@ void Map::locate_photons(
         }
     }
 
-    float dist_to_photon = (p->pos - np->pos).norm();                                                       // calculate distance to the photon
+    float dist_to_photon = (p->pos - np->pos).squaredNorm();                                                // calculate squared distance to the photon
     if (dist_to_photon < np->dist[0]) {                                                                     // if condition satisfied
         if (np->curr_num < np->max_num) {                                                                   // when heap is not full
             np->curr_num++;                                                                                // add a new photon
@@ -293,4 +379,84 @@ void Map::locate_photons(
             np->dist[0] = np->dist[1];
         }
     }
-}
\ No newline at end of file
+}
+
+void Map::locate(
+    Nearest_photons* np) {
+    if (stored_photons > 0)
+        locate_photons(np, 1);
+}
+
+bool Map::save(
+    const std::string& path) const {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    const char magic[4] = { 'P', 'M', 'A', 'P' };
+    std::fwrite(magic, 1, 4, file);
+    std::fwrite(&stored_photons, sizeof(int), 1, file);
+    std::fwrite(&emitted_photons, sizeof(int), 1, file);
+    std::fwrite(bbox_min.data(), sizeof(float), 3, file);
+    std::fwrite(bbox_max.data(), sizeof(float), 3, file);
+    std::fwrite(&photons[1], sizeof(Photon), stored_photons, file);                 // heap order, photons[0] is unused
+    return std::fclose(file) == 0;
+}
+
+bool Map::load(
+    const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    char magic[4];
+    int stored, emitted;
+    bool ok = std::fread(magic, 1, 4, file) == 4 && std::string(magic, 4) == "PMAP"
+        && std::fread(&stored, sizeof(int), 1, file) == 1 && std::fread(&emitted, sizeof(int), 1, file) == 1
+        && stored >= 0 && stored <= max_photons
+        && std::fread(bbox_min.data(), sizeof(float), 3, file) == 3 && std::fread(bbox_max.data(), sizeof(float), 3, file) == 3
+        && (int)std::fread(&photons[1], sizeof(Photon), stored, file) == stored;
+    std::fclose(file);
+    stored_photons = ok ? stored : 0;
+    emitted_photons = ok ? emitted : 0;
+    return ok;
+}
+
+bool PhotonMap::append(
+    const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    char magic[4];
+    int stored, emitted;
+    Eigen::Vector3f bounds[2];
+    bool ok = std::fread(magic, 1, 4, file) == 4 && std::string(magic, 4) == "PMAP"
+        && std::fread(&stored, sizeof(int), 1, file) == 1 && std::fread(&emitted, sizeof(int), 1, file) == 1
+        && stored >= 0 && std::fread(bounds[0].data(), sizeof(float), 3, file) == 3 && std::fread(bounds[1].data(), sizeof(float), 3, file) == 3;
+    Photon p;
+    for (int i = 0; ok && i < stored; i++) {
+        ok = std::fread(&p, sizeof(Photon), 1, file) == 1;
+        if (ok) {
+            int before = stored_photons;
+            store(p.pos, p.dir, p.power);
+            ok = stored_photons == before + 1;                                  // a full map drops the photon
+        }
+    }
+    std::fclose(file);
+    if (ok)
+        emitted_photons += emitted;
+    return ok;
+}
+
+bool PhotonMap::read_counts(
+    const std::string& path,
+    int& stored,
+    int& emitted) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    char magic[4];
+    bool ok = std::fread(magic, 1, 4, file) == 4 && std::string(magic, 4) == "PMAP"
+        && std::fread(&stored, sizeof(int), 1, file) == 1 && std::fread(&emitted, sizeof(int), 1, file) == 1
+        && stored >= 0;
+    std::fclose(file);
+    return ok;
+}
@@ -2,8 +2,13 @@
 #include <Eigen/Dense>
 #include <utility>
 #include <cmath>
+#include <vector>
+#include <limits>
 #include "ray.hpp"
+#include "aabb.hpp"
 #include "interaction.hpp"
+#include "sampler.hpp"
+#include "aliasTable.hpp"
 #define M_PIf 3.14159265358979323846f
 
 class Light
@@ -20,9 +25,36 @@ public:
 	// Set PDF and the surface position
 	// Return color of light
 	virtual Eigen::Vector3f SampleSurfacePos(Eigen::Vector3f& sampled_lightPos, float& pdf)=0;
-	virtual Eigen::Vector3f SampleLightDir(float& pdf) = 0;
-	// Determine if light is hit, if light is not delta light
-	virtual bool isHit(Ray* ray, Interaction* interaction) = 0;
+	// Sample a point on the light's surface with the normal there, for photon emission
+	// Set PDF per unit area, return color of light
+	virtual Eigen::Vector3f SampleEmissionPos(Eigen::Vector3f& sampled_lightPos, Eigen::Vector3f& normal, float& pdf)
+	{
+		Eigen::Vector3f color = SampleSurfacePos(sampled_lightPos, pdf);
+		normal = getNormal(sampled_lightPos);
+		return color;
+	}
+	// Sample an emission direction leaving a surface point with @normal, set its solid angle PDF
+	// Lights are Lambertian emitters, the direction is cosine weighted around the normal
+	virtual Eigen::Vector3f SampleLightDir(const Eigen::Vector3f& normal, float& pdf)
+	{
+		float rand1 = randomFloat();
+		float r = std::sqrt(rand1);
+		float phi = 2.0f * M_PIf * randomFloat();
+		float z = std::sqrt(std::fmax(0.0f, 1.0f - rand1));
+		pdf = z / M_PIf;
+		return Frame(normal).toWorld(Eigen::Vector3f(r * std::cos(phi), r * std::sin(phi), z));
+	}
+	// Normal of the emitting surface at a sampled surface position
+	virtual Eigen::Vector3f getNormal(const Eigen::Vector3f& surfacePos) = 0;
+	// Determine if light is hit, if light is not delta light, whatever lies in front of it
+	// @hitDist is set to the distance along the ray if given
+	virtual bool isHit(Ray* ray, float* hitDist = nullptr) = 0;
+	// Bounding box of the emitting surface
+	virtual AABB getBounds() = 0;
+	// Total emitted flux
+	virtual Eigen::Vector3f getPower() = 0;
+	// Cone around @axis with half angle @theta containing every emitting normal
+	virtual void getNormalCone(Eigen::Vector3f& axis, float& theta) = 0;
 	
 	Eigen::Vector3f m_Pos;
 	Eigen::Vector3f m_Color;
@@ -37,44 +69,352 @@ public:
 	
 	Eigen::Vector3f SampleSurfacePos(Eigen::Vector3f& sampled_lightPos, float& pdf) override {
 		// TODO
-		float rand1 = (float)std::rand() / (float)RAND_MAX;
-		float r = std::sqrtf(rand1);
-		float rand2 = (float)std::rand() / (float)RAND_MAX;
+		float rand1 = randomFloat();
+		float r = std::sqrt(rand1);
+		float rand2 = randomFloat();
 		float phi = 2.0f * M_PIf * (rand2);
-		float x = r * std::cosf(phi);
-		float z = r * std::sinf(phi);
+		float x = r * std::cos(phi);
+		float z = r * std::sin(phi);
 		Eigen::Vector3f localPos(x, 0.0f, z);
 		sampled_lightPos = localPos + m_Pos;
 		pdf = 1.0f / M_PIf;
 		return m_Color;
 	}
 
-	Eigen::Vector3f SampleLightDir(float& pdf) override
+	Eigen::Vector3f getNormal(const Eigen::Vector3f& /*surfacePos*/) override
 	{
-		float rand1 = (float)std::rand() / (float)RAND_MAX;
-		float r = std::sqrtf(rand1);
-		float rand2 = (float)std::rand() / (float)RAND_MAX;
-		float phi = 2.0f * M_PIf * (rand2);
-		float x = r * std::cosf(phi);
-		float z = r * std::sinf(phi);
-		float y = -sqrtf(1.0f - x * x - z * z);
-		pdf = 1.0f / M_PIf;
-		return { x,y,z };
+		return { 0.0f,-1.0f,0.0f };
 	}
 
-	bool isHit(Ray* ray, Interaction* interaction) override {
+	bool isHit(Ray* ray, float* hitDist = nullptr) override {
 		// TODO
 		if (ray->m_Dir.y() == 0)
 			return false;
 		float t = (m_Pos.y() - ray->m_Ori.y()) / ray->m_Dir.y();
 		if (t > ray->m_fMax || t < ray->m_fMin)
 			return false;
-		if (interaction->isInteraction == true && interaction->entryDist < t)
-			return false;
 		float x = ray->m_Ori.x() + t * ray->m_Dir.x();
 		float z = ray->m_Ori.z() + t * ray->m_Dir.z();
 		if ((x - m_Pos.x()) * (x - m_Pos.x()) + (z - m_Pos.z()) * (z - m_Pos.z()) > 1)
 			return false;
+		if (hitDist != nullptr)
+			*hitDist = t;
+		return true;
+	}
+
+	// unit disc in the xz plane, thickened a little so the box can be hit by rays
+	AABB getBounds() override
+	{
+		return AABB(m_Pos - Eigen::Vector3f(1.0f, 1e-4f, 1.0f), m_Pos + Eigen::Vector3f(1.0f, 1e-4f, 1.0f));
+	}
+
+	// Lambertian emitter of area pi
+	Eigen::Vector3f getPower() override
+	{
+		return m_Color * M_PIf * M_PIf;
+	}
+
+	void getNormalCone(Eigen::Vector3f& axis, float& theta) override
+	{
+		axis = Eigen::Vector3f(0.0f, -1.0f, 0.0f);
+		theta = 0.0f;
+	}
+};
+
+// Parallelogram @corner + u * @edge0 + v * @edge1, emitting on the side of edge0 x edge1
+class QuadLight : public Light
+{
+public:
+	QuadLight(const Eigen::Vector3f& corner, const Eigen::Vector3f& edge0, const Eigen::Vector3f& edge1, Eigen::Vector3f color)
+		: Light(corner + 0.5f * (edge0 + edge1), std::move(color)), corner(corner), edge0(edge0), edge1(edge1)
+	{
+		Eigen::Vector3f cross = edge0.cross(edge1);
+		area = cross.norm();
+		normal = cross / area;
+	}
+
+	Eigen::Vector3f SampleSurfacePos(Eigen::Vector3f& sampled_lightPos, float& pdf) override
+	{
+		float u = randomFloat();
+		float v = randomFloat();
+		sampled_lightPos = corner + u * edge0 + v * edge1;
+		pdf = 1.0f / area;
+		return m_Color;
+	}
+
+	Eigen::Vector3f getNormal(const Eigen::Vector3f& /*surfacePos*/) override
+	{
+		return normal;
+	}
+
+	bool isHit(Ray* ray, float* hitDist = nullptr) override
+	{
+		float cosRay = ray->m_Dir.dot(normal);
+		if (cosRay == 0.0f)
+			return false;
+		float t = (corner - ray->m_Ori).dot(normal) / cosRay;
+		if (t > ray->m_fMax || t < ray->m_fMin)
+			return false;
+		// coordinates of the hit along the edges, which need not be perpendicular
+		Eigen::Vector3f d = ray->getPoint(t) - corner;
+		float u = d.cross(edge1).dot(normal) / area;
+		float v = edge0.cross(d).dot(normal) / area;
+		if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f)
+			return false;
+		if (hitDist != nullptr)
+			*hitDist = t;
 		return true;
 	}
-};
\ No newline at end of file
+
+	AABB getBounds() override
+	{
+		Eigen::Vector3f pad(1e-4f, 1e-4f, 1e-4f);
+		AABB bounds(corner, corner + edge0, corner + edge1);
+		bounds = AABB(bounds, AABB(corner + edge0 + edge1, corner + edge0 + edge1));
+		return AABB(bounds.lb - pad, bounds.ub + pad);
+	}
+
+	Eigen::Vector3f getPower() override
+	{
+		return m_Color * M_PIf * area;
+	}
+
+	void getNormalCone(Eigen::Vector3f& axis, float& theta) override
+	{
+		axis = normal;
+		theta = 0.0f;
+	}
+
+	Eigen::Vector3f corner, edge0, edge1;
+
+private:
+	Eigen::Vector3f normal;
+	float area;
+};
+
+// Sphere emitting outwards from every point of its surface
+class SphereLight : public Light
+{
+public:
+	SphereLight(Eigen::Vector3f center, float radius, Eigen::Vector3f color)
+		: Light(std::move(center), std::move(color)), radius(radius)
+	{
+	}
+
+	// uniform over the surface
+	Eigen::Vector3f SampleSurfacePos(Eigen::Vector3f& sampled_lightPos, float& pdf) override
+	{
+		float z = 1.0f - 2.0f * randomFloat();
+		float r = std::sqrt(std::fmax(0.0f, 1.0f - z * z));
+		float phi = 2.0f * M_PIf * randomFloat();
+		sampled_lightPos = m_Pos + radius * Eigen::Vector3f(r * std::cos(phi), r * std::sin(phi), z);
+		pdf = 1.0f / (4.0f * M_PIf * radius * radius);
+		return m_Color;
+	}
+
+	Eigen::Vector3f getNormal(const Eigen::Vector3f& surfacePos) override
+	{
+		return (surfacePos - m_Pos).normalized();
+	}
+
+	bool isHit(Ray* ray, float* hitDist = nullptr) override
+	{
+		Eigen::Vector3f oc = ray->m_Ori - m_Pos;
+		float a = ray->m_Dir.squaredNorm();
+		float b = oc.dot(ray->m_Dir);
+		float c = oc.squaredNorm() - radius * radius;
+		float disc = b * b - a * c;
+		if (disc < 0.0f)
+			return false;
+		float root = std::sqrt(disc);
+		float t = (-b - root) / a;
+		if (t < ray->m_fMin)
+			t = (-b + root) / a;
+		if (t > ray->m_fMax || t < ray->m_fMin)
+			return false;
+		if (hitDist != nullptr)
+			*hitDist = t;
+		return true;
+	}
+
+	AABB getBounds() override
+	{
+		return AABB(m_Pos, radius);
+	}
+
+	Eigen::Vector3f getPower() override
+	{
+		return m_Color * M_PIf * 4.0f * M_PIf * radius * radius;
+	}
+
+	// normals point every way
+	void getNormalCone(Eigen::Vector3f& axis, float& theta) override
+	{
+		axis = Eigen::Vector3f(0.0f, 1.0f, 0.0f);
+		theta = M_PIf;
+	}
+
+	float radius;
+};
+
+// Triangle mesh emitting on the front side of every triangle, the side its vertices wind
+// counterclockwise around. Points are sampled uniformly by area: a triangle is picked from
+// an alias table over the triangle areas, then a point inside it.
+class MeshLight : public Light
+{
+public:
+	// @vertices holds 3 corners per triangle
+	MeshLight(std::vector<Eigen::Vector3f> vertices, Eigen::Vector3f color)
+		: Light(Eigen::Vector3f::Zero(), std::move(color)), vertices(std::move(vertices))
+	{
+		int count = (int)this->vertices.size() / 3;
+		std::vector<float> areas(count);
+		normals.resize(count);
+		area = 0.0f;
+		for (int i = 0; i < count; i++)
+		{
+			Eigen::Vector3f cross = (this->vertices[3 * i + 1] - this->vertices[3 * i]).cross(this->vertices[3 * i + 2] - this->vertices[3 * i]);
+			areas[i] = 0.5f * cross.norm();
+			normals[i] = areas[i] > 0.0f ? Eigen::Vector3f(cross.normalized()) : Eigen::Vector3f::Zero();
+			area += areas[i];
+			m_Pos += areas[i] * (this->vertices[3 * i] + this->vertices[3 * i + 1] + this->vertices[3 * i + 2]) / 3.0f;
+		}
+		if (area > 0.0f)
+			m_Pos /= area;
+		triangles.build(areas);
+	}
+
+	Eigen::Vector3f SampleSurfacePos(Eigen::Vector3f& sampled_lightPos, float& pdf) override
+	{
+		Eigen::Vector3f normal;
+		return SampleEmissionPos(sampled_lightPos, normal, pdf);
+	}
+
+	Eigen::Vector3f SampleEmissionPos(Eigen::Vector3f& sampled_lightPos, Eigen::Vector3f& normal, float& pdf) override
+	{
+		pdf = 0.0f;
+		normal = Eigen::Vector3f::Zero();
+		if (triangles.empty())
+			return Eigen::Vector3f::Zero();
+		float trianglePmf;
+		int i = triangles.sample(randomFloat(), trianglePmf);
+		// uniform barycentrics by folding the unit square
+		float u = randomFloat(), v = randomFloat();
+		if (u + v > 1.0f)
+		{
+			u = 1.0f - u;
+			v = 1.0f - v;
+		}
+		sampled_lightPos = vertices[3 * i] + u * (vertices[3 * i + 1] - vertices[3 * i]) + v * (vertices[3 * i + 2] - vertices[3 * i]);
+		normal = normals[i];
+		pdf = 1.0f / area;	// the triangle pick is proportional to its area
+		return m_Color;
+	}
+
+	// normal of the triangle whose plane is closest to the point among those containing it,
+	// a scan over every triangle; samplers take the normal from SampleEmissionPos instead
+	Eigen::Vector3f getNormal(const Eigen::Vector3f& surfacePos) override
+	{
+		int best = 0;
+		float bestDist = std::numeric_limits<float>::max();
+		for (int i = 0; i < (int)normals.size(); i++)
+		{
+			float dist = std::fabs((surfacePos - vertices[3 * i]).dot(normals[i]));
+			if (dist < bestDist && contains(i, surfacePos))
+			{
+				best = i;
+				bestDist = dist;
+			}
+		}
+		return normals.empty() ? Eigen::Vector3f::Zero() : normals[best];
+	}
+
+	bool isHit(Ray* ray, float* hitDist = nullptr) override
+	{
+		float closest = ray->m_fMax;
+		bool hit = false;
+		for (int i = 0; i < (int)normals.size(); i++)
+		{
+			// Moller-Trumbore
+			Eigen::Vector3f e1 = vertices[3 * i + 1] - vertices[3 * i];
+			Eigen::Vector3f e2 = vertices[3 * i + 2] - vertices[3 * i];
+			Eigen::Vector3f p = ray->m_Dir.cross(e2);
+			float det = e1.dot(p);
+			if (std::fabs(det) < 1e-12f)
+				continue;
+			Eigen::Vector3f s = ray->m_Ori - vertices[3 * i];
+			float u = s.dot(p) / det;
+			if (u < 0.0f || u > 1.0f)
+				continue;
+			Eigen::Vector3f q = s.cross(e1);
+			float v = ray->m_Dir.dot(q) / det;
+			if (v < 0.0f || u + v > 1.0f)
+				continue;
+			float t = e2.dot(q) / det;
+			if (t < ray->m_fMin || t > closest)
+				continue;
+			closest = t;
+			hit = true;
+		}
+		if (!hit)
+			return false;
+		if (hitDist != nullptr)
+			*hitDist = closest;
+		return true;
+	}
+
+	AABB getBounds() override
+	{
+		Eigen::Vector3f pad(1e-4f, 1e-4f, 1e-4f);
+		if (vertices.empty())
+			return AABB(m_Pos, m_Pos);
+		AABB bounds(vertices[0], vertices[0]);
+		for (const Eigen::Vector3f& v : vertices)
+			bounds = AABB(bounds, AABB(v, v));
+		return AABB(bounds.lb - pad, bounds.ub + pad);
+	}
+
+	Eigen::Vector3f getPower() override
+	{
+		return m_Color * M_PIf * area;
+	}
+
+	// cone around the area weighted mean normal through the farthest triangle normal
+	void getNormalCone(Eigen::Vector3f& axis, float& theta) override
+	{
+		Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+		for (int i = 0; i < (int)normals.size(); i++)
+			sum += triangles.pmf(i) * normals[i];
+		if (triangles.empty() || sum.norm() < 1e-4f)
+		{
+			axis = Eigen::Vector3f(0.0f, 1.0f, 0.0f);
+			theta = M_PIf;
+			return;
+		}
+		axis = sum.normalized();
+		float cosMin = 1.0f;
+		for (int i = 0; i < (int)normals.size(); i++)
+			if (triangles.pmf(i) > 0.0f)
+				cosMin = std::min(cosMin, axis.dot(normals[i]));
+		theta = std::acos(std::max(-1.0f, std::min(1.0f, cosMin)));
+	}
+
+	std::vector<Eigen::Vector3f> vertices;
+
+private:
+	bool contains(int i, const Eigen::Vector3f& p) const
+	{
+		const float eps = 1e-4f;
+		for (int k = 0; k < 3; k++)
+		{
+			Eigen::Vector3f edge = vertices[3 * i + (k + 1) % 3] - vertices[3 * i + k];
+			if (edge.cross(p - vertices[3 * i + k]).dot(normals[i]) < -eps * edge.norm())
+				return false;
+		}
+		return true;
+	}
+
+	std::vector<Eigen::Vector3f> normals;
+	AliasTable triangles;
+	float area;
+};
@@ -0,0 +1,258 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include "Eigen/Dense"
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "light.hpp"
+
+// Bounding volume hierarchy over the lights of a scene.
+// Every node bounds its lights in space, sums their power and keeps a cone bounding their
+// emitting normals. Sampling walks down the tree picking a child by its importance to the
+// shading point, so a light is picked in O(log n) with probability roughly proportional
+// to its unshadowed contribution. Emitter hit tests traverse the same boxes.
+class LightBVH
+{
+public:
+	struct Node
+	{
+		AABB bounds{ Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero() };
+		// normals of all lights below lie within theta of axis
+		Eigen::Vector3f axis = Eigen::Vector3f(0.0f, 0.0f, 1.0f);
+		float theta = 0.0f;
+		// scalar power (luminance of the flux) of all lights below
+		float power = 0.0f;
+		// children, or -1 for a leaf
+		int left = -1, right = -1;
+		// light index for a leaf
+		int light = -1;
+	};
+
+	void build(const std::vector<Light*>& sceneLights)
+	{
+		lights = sceneLights;
+		nodes.clear();
+		maxDepth = 0;
+		if (lights.empty())
+			return;
+		std::vector<int> indices(lights.size());
+		for (int i = 0; i < (int)lights.size(); i++)
+			indices[i] = i;
+		nodes.reserve(2 * lights.size());
+		buildNode(indices, 0, (int)indices.size(), 0);
+	}
+
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+
+	// Pick a light by its importance to point @p with normal @n (n may be zero for no normal)
+	// Return the light index, or -1 if no light can contribute; @pmf is the probability of the pick
+	int sample(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float u, float& pmf) const
+	{
+		return sampleTree(p, n, u, pmf);
+	}
+
+	// Closest light hit by @ray nearer than @closest, the distance of the surface the ray hit,
+	// -1 if none
+	int intersect(Ray* ray, float closest = std::numeric_limits<float>::max()) const
+	{
+		int hitLight = -1;
+		if (nodes.empty())
+			return hitLight;
+		// a walk holds at most one node per level plus one, on the heap for very deep trees
+		int local[stackSize];
+		std::vector<int> deep;
+		int* stack = local;
+		if (maxDepth + 1 > stackSize)
+		{
+			deep.resize(maxDepth + 1);
+			stack = deep.data();
+		}
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const Node& node = nodes[stack[--top]];
+			float tmin, tmax;
+			AABB box = node.bounds;
+			if (!box.rayIntersection(*ray, tmin, tmax) || tmin > closest)
+				continue;
+			if (node.light != -1)
+			{
+				float t = std::numeric_limits<float>::max();
+				if (lights[node.light]->isHit(ray, &t) && t <= closest)
+				{
+					closest = t;
+					hitLight = node.light;
+				}
+			}
+			else
+			{
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+			}
+		}
+		return hitLight;
+	}
+
+	// scalar power of a flux, the weight lights are picked by
+	static float luminance(const Eigen::Vector3f& c)
+	{
+		return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+	}
+
+	std::vector<Node> nodes;
+
+private:
+	enum { stackSize = 64 };
+
+	// walk from the root to a leaf, choosing children by importance
+	int sampleTree(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float u, float& pmf) const
+	{
+		pmf = 0.0f;
+		if (nodes.empty())
+			return -1;
+		int node = 0;
+		float prob = 1.0f;
+		while (nodes[node].light == -1)
+		{
+			const Node& left = nodes[nodes[node].left];
+			const Node& right = nodes[nodes[node].right];
+			float il = importance(left, p, n);
+			float ir = importance(right, p, n);
+			if (il + ir <= 0.0f)
+				return -1;
+			float pl = il / (il + ir);
+			if (u < pl)
+			{
+				u = std::min(u / pl, 0.99999994f);	// reuse the random number
+				prob *= pl;
+				node = nodes[node].left;
+			}
+			else
+			{
+				u = std::min((u - pl) / (1.0f - pl), 0.99999994f);
+				prob *= 1.0f - pl;
+				node = nodes[node].right;
+			}
+		}
+		pmf = prob;
+		return nodes[node].light;
+	}
+
+	// Upper bound on the contribution of a node's lights to a point, after Conty and Kulla
+	static float importance(const Node& node, const Eigen::Vector3f& p, const Eigen::Vector3f& n)
+	{
+		Eigen::Vector3f center = node.bounds.getCenter();
+		Eigen::Vector3f toLight = center - p;
+		float halfDiag = 0.5f * node.bounds.diagonalLength();
+		float d2 = std::max(toLight.squaredNorm(), halfDiag * halfDiag);	// do not blow up inside the box
+		float d = std::sqrt(toLight.squaredNorm());
+		if (d == 0.0f)
+			return node.power / d2;
+		Eigen::Vector3f wi = toLight / d;
+
+		// angle the box subtends seen from p
+		float thetaU = d > halfDiag ? std::asin(halfDiag / d) : M_PIf;
+
+		// emitter side, lights emit within pi/2 of their normals
+		float cosTheta = std::max(-1.0f, std::min(1.0f, node.axis.dot(-wi)));
+		float thetaEmit = std::max(0.0f, std::acos(cosTheta) - node.theta - thetaU);
+		if (thetaEmit >= 0.5f * M_PIf)
+			return 0.0f;
+
+		// receiver side
+		float cosReceive = 1.0f;
+		if (n.squaredNorm() > 0.0f)
+		{
+			float cosI = std::max(-1.0f, std::min(1.0f, n.dot(wi)));
+			float thetaI = std::max(0.0f, std::acos(cosI) - thetaU);
+			if (thetaI >= 0.5f * M_PIf)
+				return 0.0f;
+			cosReceive = std::cos(thetaI);
+		}
+		return node.power * std::cos(thetaEmit) * cosReceive / d2;
+	}
+
+	// Smallest cone bounding two cones
+	static void mergeCones(Eigen::Vector3f axisA, float thetaA, Eigen::Vector3f axisB, float thetaB, Eigen::Vector3f& axis, float& theta)
+	{
+		if (thetaB > thetaA)
+		{
+			std::swap(axisA, axisB);
+			std::swap(thetaA, thetaB);
+		}
+		float thetaD = std::acos(std::max(-1.0f, std::min(1.0f, axisA.dot(axisB))));
+		if (std::min(thetaD + thetaB, M_PIf) <= thetaA)
+		{
+			axis = axisA;
+			theta = thetaA;
+			return;
+		}
+		theta = 0.5f * (thetaA + thetaD + thetaB);
+		Eigen::Vector3f w = axisA.cross(axisB);
+		if (theta >= M_PIf || w.squaredNorm() < 1e-12f)
+		{
+			axis = axisA;
+			theta = M_PIf;
+			return;
+		}
+		axis = Eigen::AngleAxisf(theta - thetaA, w.normalized()) * axisA;
+	}
+
+	int buildNode(std::vector<int>& indices, int begin, int end, int depth)
+	{
+		int nodeIdx = (int)nodes.size();
+		nodes.push_back(Node());
+		maxDepth = std::max(maxDepth, depth);
+		if (end - begin == 1)
+		{
+			Light* light = lights[indices[begin]];
+			Node& leaf = nodes[nodeIdx];
+			leaf.bounds = light->getBounds();
+			light->getNormalCone(leaf.axis, leaf.theta);
+			leaf.power = luminance(light->getPower());
+			leaf.light = indices[begin];
+			return nodeIdx;
+		}
+
+		// split at the middle of the longest axis of the centers, median if that fails
+		AABB centers(lights[indices[begin]]->getBounds().getCenter(), lights[indices[begin]]->getBounds().getCenter());
+		for (int i = begin + 1; i < end; i++)
+		{
+			Eigen::Vector3f c = lights[indices[i]]->getBounds().getCenter();
+			centers = AABB(centers, AABB(c, c));
+		}
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+			if (centers.getDist(i) > centers.getDist(axis))
+				axis = i;
+		float split = centers.getCenter()[axis];
+		int mid = (int)(std::partition(indices.begin() + begin, indices.begin() + end,
+			[&](int l) { return lights[l]->getBounds().getCenter()[axis] < split; }) - indices.begin());
+		if (mid == begin || mid == end || depth >= 32)	// median splits keep deep trees balanced
+		{
+			mid = (begin + end) / 2;
+			std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end,
+				[&](int a, int b) { return lights[a]->getBounds().getCenter()[axis] < lights[b]->getBounds().getCenter()[axis]; });
+		}
+
+		int left = buildNode(indices, begin, mid, depth + 1);
+		int right = buildNode(indices, mid, end, depth + 1);
+		Node& node = nodes[nodeIdx];
+		node.left = left;
+		node.right = right;
+		node.bounds = AABB(nodes[left].bounds, nodes[right].bounds);
+		node.power = nodes[left].power + nodes[right].power;
+		mergeCones(nodes[left].axis, nodes[left].theta, nodes[right].axis, nodes[right].theta, node.axis, node.theta);
+		return nodeIdx;
+	}
+
+	std::vector<Light*> lights;
+	// depth of the deepest leaf, the root at 0
+	int maxDepth = 0;
+};
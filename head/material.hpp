@@ -1,6 +1,7 @@
 #pragma once
 #include "Eigen/Dense"
 #include "interaction.hpp"
+#include "sampler.hpp"
 #define M_PIf 3.14159265358979323846f
 class BSDF
 {
@@ -12,7 +13,8 @@ public:
 
 	// Evaluate the BSDF
 	// The information in @Interaction contains ray's direction, normal
-	// and other information that you might need
+	// and other information that you might need; directions are unit vectors
+	// and _interact.frame is the shading frame of the hit
 	virtual Eigen::Vector3f eval(Interaction& _interact) = 0;
 
 	// Sample a direction based on the BSDF
@@ -23,23 +25,6 @@ public:
 	// Mark if the BSDF is specular
 	bool isSpecular;
 	float clamp(float x) { return x < 0.0f ? 0.0f : x > 1.0f ? 1.0f : x; }
-	Eigen::Vector3f rotate(Eigen::Vector3f oriVec, Eigen::Vector3f oriNormal, Eigen::Vector3f newNormal)
-	{
-		Eigen::Matrix3f I, tmp, rotation;
-		Eigen::Vector3f a = oriNormal.normalized();
-		Eigen::Vector3f b = newNormal.normalized();
-		if (a == -b)
-			return -oriVec;
-		if (a == b)
-			return oriVec;
-		Eigen::Vector3f v = a.cross(b);
-		float s = v.norm();
-		float c = a.dot(b);
-		tmp << 0.0f, -v.z(), v.y(), v.z(), 0.0f, -v.x(), -v.y(), v.x(), 0.0f;
-		I << 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f;
-		rotation = I + tmp + tmp * tmp / (1.0f + c);
-		return rotation * oriVec;
-	}
 };
 
 
@@ -49,38 +34,22 @@ public:
 
 	Eigen::Vector3f eval(Interaction& _interact)
 	{
-		// TODO
-		Eigen::Vector3f result;
-		Eigen::Vector3f N = _interact.normal.normalized();
-		Eigen::Vector3f V = _interact.outputDir.normalized();
-		Eigen::Vector3f L = _interact.inputDir.normalized();
-		float NdotL = N.dot(L);
-		float NdotV = N.dot(V);
-		if (NdotL <= 0.0f || NdotV <= 0.0f)
-		{
-			result.x() = 0.0f;
-			result.y() = 0.0f;
-			result.z() = 0.0f;
-			return result;
-		}
-		result = clamp(NdotL) * _interact.surfaceColor / M_PIf;
-		return result;
+		float cosL = _interact.frame.n.dot(_interact.inputDir);
+		float cosV = _interact.frame.n.dot(_interact.outputDir);
+		if (cosL <= 0.0f || cosV <= 0.0f)
+			return Eigen::Vector3f(0.0f, 0.0f, 0.0f);
+		return clamp(cosL) * _interact.surfaceColor / M_PIf;
 	};
 
+	// cosine-weighted hemisphere around the normal
 	float sample(Interaction& _interact)
 	{
-		// TODO
-		float rand1 = (float)std::rand() / (float)RAND_MAX;
-		float r = std::sqrtf(rand1);
-		float rand2 = (float)std::rand() / (float)RAND_MAX;
-		float phi = 2.0f * M_PIf * (rand2);
-		float x = r * std::cosf(phi);
-		float y = r * std::sinf(phi);
-		float z = std::sqrtf(std::fmaxf(0.0f, 1.0f - x * x - y * y));
-		Eigen::Vector3f outputDir(x, y, z);
-		outputDir = rotate(outputDir, { 0.0f,0.0f,1.0f }, _interact.normal);
-		_interact.outputDir = outputDir.normalized();
-		return std::fabsf(_interact.inputDir.dot(_interact.normal)) / M_PIf;
+		float rand1 = randomFloat();
+		float r = std::sqrt(rand1);
+		float phi = 2.0f * M_PIf * randomFloat();
+		float z = std::sqrt(std::fmax(0.0f, 1.0f - rand1));
+		_interact.outputDir = _interact.frame.toWorld(Eigen::Vector3f(r * std::cos(phi), r * std::sin(phi), z));
+		return z / M_PIf;
 	};
 };
 
@@ -94,33 +63,82 @@ public:
 
 	Eigen::Vector3f eval(Interaction& _interact)
 	{
-		// TODO
 		float epslon = 1e-4;
-		Eigen::Vector3f result;
-		Eigen::Vector3f N = _interact.normal.normalized();
-		Eigen::Vector3f V = _interact.outputDir.normalized();
-		Eigen::Vector3f L = _interact.inputDir.normalized();
-		float NdotL = N.dot(L);
-		Eigen::Vector3f tmp = -L + 2.0f * NdotL * N;
-		if (std::fabsf(tmp.x() - V.x()) >= epslon && std::fabsf(tmp.y() - V.y()) >= epslon && std::fabsf(tmp.y() - V.y()) >= epslon)
+		Eigen::Vector3f L = _interact.frame.toLocal(_interact.inputDir);
+		Eigen::Vector3f V = _interact.frame.toLocal(_interact.outputDir);
+		// the mirror direction of L is (-L.x, -L.y, L.z)
+		if (std::fabs(V.x() + L.x()) >= epslon || std::fabs(V.y() + L.y()) >= epslon || std::fabs(V.z() - L.z()) >= epslon)
+			return Eigen::Vector3f(0.0f, 0.0f, 0.0f);
+		return clamp(L.z()) * _interact.surfaceColor;
+	};
+
+	float sample(Interaction& _interact)
+	{
+		Eigen::Vector3f L = _interact.frame.toLocal(_interact.inputDir);
+		_interact.outputDir = _interact.frame.toWorld(Eigen::Vector3f(-L.x(), -L.y(), L.z()));
+		return 1.0f;
+	};
+};
+
+class Dielectric : public BSDF
+{
+public:
+
+	// @ior index of refraction of the inside of the surface, the outside is vacuum
+	Dielectric(float ior = 1.5f) : ior(ior) {
+		isSpecular = true;
+	}
+
+	// Unpolarized Fresnel reflectance of a smooth dielectric interface
+	// @cosI  cosine between the incident direction and the normal on the incident side
+	// @eta   ratio of the incident to the transmitted index of refraction
+	// @cosT  cosine of the transmitted direction, 0 on total internal reflection
+	static float fresnel(float cosI, float eta, float& cosT)
+	{
+		float sin2T = eta * eta * (1.0f - cosI * cosI);
+		if (sin2T >= 1.0f)
 		{
-			result.x() = 0.0f;
-			result.y() = 0.0f;
-			result.z() = 0.0f;
-			return result;
+			cosT = 0.0f;
+			return 1.0f;
 		}
-		result = clamp(NdotL) * _interact.surfaceColor;
-		return result;
+		cosT = sqrtf(1.0f - sin2T);
+		float rs = (eta * cosI - cosT) / (eta * cosI + cosT);
+		float rp = (cosI - eta * cosT) / (cosI + eta * cosT);
+		return 0.5f * (rs * rs + rp * rp);
+	}
+
+	Eigen::Vector3f eval(Interaction& _interact)
+	{
+		float cosI = _interact.frame.n.dot(_interact.inputDir);
+		float cosO = _interact.frame.n.dot(_interact.outputDir);
+		if (cosO == 0.0f)
+			return Eigen::Vector3f(0.0f, 0.0f, 0.0f);
+		float eta = cosI >= 0.0f ? 1.0f / ior : ior;
+		float cosT;
+		float F = fresnel(std::fabs(cosI), eta, cosT);
+		// delta lobes, divided by the cosine the integrators multiply with
+		float weight = (cosI >= 0.0f) == (cosO >= 0.0f) ? F : 1.0f - F;
+		return weight * _interact.surfaceColor / std::fabs(cosO);
 	};
 
+	// Chooses reflection or refraction with probability given by the Fresnel term
+	// and returns the probability of the chosen lobe
 	float sample(Interaction& _interact)
 	{
-		// TODO
-		Eigen::Vector3f L = _interact.inputDir.normalized();
-		Eigen::Vector3f N = _interact.normal.normalized();
-		float LdotN = L.dot(N);
-		Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-		_interact.outputDir = outputDir.normalized();
-		return 1.0f;
+		Eigen::Vector3f L = _interact.frame.toLocal(_interact.inputDir);
+		float eta = L.z() >= 0.0f ? 1.0f / ior : ior;	// ior when leaving the object
+		float cosT;
+		float F = fresnel(std::fabs(L.z()), eta, cosT);
+		float rand = randomFloat();
+		if (rand < F) //reflect, always taken on total internal reflection
+		{
+			_interact.outputDir = _interact.frame.toWorld(Eigen::Vector3f(-L.x(), -L.y(), L.z()));
+			return F;
+		}
+		// the tangential part scales by eta, the normal part points to the other side
+		_interact.outputDir = _interact.frame.toWorld(Eigen::Vector3f(-eta * L.x(), -eta * L.y(), L.z() >= 0.0f ? -cosT : cosT));
+		return 1.0f - F;
 	};
-};
\ No newline at end of file
+
+	float ior;
+};
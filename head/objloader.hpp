@@ -4,6 +4,12 @@
 #include <stdlib.h>
 #include <vector>
 #include <map>
+#include <cstring>
+#include <charconv>
+#include <atomic>
+#include <algorithm>
+#include "mappedFile.hpp"
+#include "tileScheduler.hpp"
 //#include "../3rdLibs/glm/glm/glm.hpp"
 #include "Eigen/Dense"
 
@@ -52,7 +58,7 @@ bool loadOBJ(const char* path, std::vector<Eigen::Vector3f>& out_vertices, std::
 
         char lineHeader[64];
         // read the first word of the line
-        int res = fscanf(file, "%s", lineHeader,64);
+        int res = fscanf(file, "%63s", lineHeader);
         //printf("%s\n", lineHeader);
         if (res == EOF)
             break;
@@ -125,67 +131,207 @@ bool loadOBJ_index(
 
 
 
+// What one line-aligned chunk of an OBJ file holds.
+// Face corners are 0-based; a negative index in the file counts back from the last element
+// defined before it, which may lie in an earlier chunk, so such corners are stored relative
+// to the start of the chunk and flagged, and fixed up once the chunk offsets are known.
+struct OBJChunk {
+    std::vector<Eigen::Vector3f> vertices;
+    std::vector<Eigen::Vector2f> uvs;
+    std::vector<Eigen::Vector3f> normals;
+    std::vector<int> v_index, vt_index, vn_index;   // three corners per triangle, -1 if absent
+    std::vector<unsigned char> relative;            // per corner, bit 0 v, bit 1 vt, bit 2 vn
+    const char* error = nullptr;                    // first line that could not be parsed
+};
+
+inline const char* skipBlanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+inline bool parseFloats(const char*& p, const char* end, float* values, int count) {
+    for (int i = 0; i < count; i++) {
+        p = skipBlanks(p, end);
+        if (p < end && *p == '+')
+            p++;
+        std::from_chars_result r = std::from_chars(p, end, values[i]);
+        if (r.ec != std::errc())
+            return false;
+        p = r.ptr;
+    }
+    return true;
+}
+
+// one v, v/vt, v//vn or v/vt/vn corner, @index gets the 0-based element or the chunk-relative one
+inline bool parseCorner(const char*& p, const char* end, const int counts[3], int index[3], unsigned char& relative) {
+    relative = 0;
+    for (int k = 0; k < 3; k++) {
+        index[k] = -1;
+        if (k > 0) {
+            if (p >= end || *p != '/')
+                continue;
+            p++;
+            if (p < end && *p == '/' && k == 1)            // v//vn
+                continue;
+        }
+        int value;
+        std::from_chars_result r = std::from_chars(p, end, value);
+        if (r.ec != std::errc() || value == 0)
+            return false;
+        p = r.ptr;
+        if (value > 0)
+            index[k] = value - 1;
+        else {
+            index[k] = counts[k] + value;
+            relative |= 1 << k;
+        }
+    }
+    return true;
+}
+
+inline void parseOBJChunk(const char* begin, const char* end, OBJChunk& chunk) {
+    std::vector<int> corners;
+    std::vector<unsigned char> cornerRelative;
+    for (const char* line = begin; line < end; ) {
+        const char* eol = (const char*)std::memchr(line, '\n', end - line);
+        if (eol == nullptr)
+            eol = end;
+        const char* p = skipBlanks(line, eol);
+        const char* lineStart = line;
+        line = eol + 1;
+        if (p + 1 >= eol || p[0] == '#')
+            continue;
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            float v[3];
+            p += 2;
+            if (!parseFloats(p, eol, v, 3)) { chunk.error = lineStart; return; }
+            chunk.vertices.emplace_back(v[0], v[1], v[2]);
+        }
+        else if (p[0] == 'v' && p[1] == 't' && p + 2 < eol && (p[2] == ' ' || p[2] == '\t')) {
+            float v[2];
+            p += 3;
+            if (!parseFloats(p, eol, v, 2)) { chunk.error = lineStart; return; }
+            chunk.uvs.emplace_back(v[0], v[1]);
+        }
+        else if (p[0] == 'v' && p[1] == 'n' && p + 2 < eol && (p[2] == ' ' || p[2] == '\t')) {
+            float v[3];
+            p += 3;
+            if (!parseFloats(p, eol, v, 3)) { chunk.error = lineStart; return; }
+            chunk.normals.emplace_back(v[0], v[1], v[2]);
+        }
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            // any polygon, split into a fan of triangles around its first corner
+            const int counts[3] = { (int)chunk.vertices.size(), (int)chunk.uvs.size(), (int)chunk.normals.size() };
+            corners.clear();
+            cornerRelative.clear();
+            p = skipBlanks(p + 1, eol);
+            while (p < eol) {
+                int index[3];
+                unsigned char relative;
+                if (!parseCorner(p, eol, counts, index, relative)) { chunk.error = lineStart; return; }
+                corners.insert(corners.end(), index, index + 3);
+                cornerRelative.push_back(relative);
+                p = skipBlanks(p, eol);
+            }
+            int n = (int)cornerRelative.size();
+            if (n < 3) { chunk.error = lineStart; return; }
+            for (int i = 1; i + 1 < n; i++) {
+                for (int c : { 0, i, i + 1 }) {
+                    chunk.v_index.push_back(corners[3 * c]);
+                    chunk.vt_index.push_back(corners[3 * c + 1]);
+                    chunk.vn_index.push_back(corners[3 * c + 2]);
+                    chunk.relative.push_back(cornerRelative[c]);
+                }
+            }
+        }
+        // o, g, s, usemtl, mtllib and anything else carry nothing we use
+    }
+}
+
+// Memory-maps the file, parses line-aligned chunks of it on all hardware threads, then
+// copies every chunk into buffers sized once for the whole file. Faces may be any
+// polygon (split into triangles) with v, v/vt, v//vn or v/vt/vn corners and negative
+// indices. Out indices are 0-based, -1 where a face has no uv or normal.
 bool loadOBJ_index(const char* path, 
     std::vector<Eigen::Vector3f>& out_vertices, std::vector<Eigen::Vector2f>& out_uvs, std::vector<Eigen::Vector3f >& out_normals, 
     std::vector < int >& out_v_index, std::vector < int >& out_vt_index, std::vector < int >& out_vn_index)
 {
-    std::vector< unsigned int > vertexIndices, uvIndices, normalIndices;
-    std::vector< Eigen::Vector3f > temp_vertices;
-    std::vector< Eigen::Vector2f > temp_uvs;
-    std::vector< Eigen::Vector3f > temp_normals;
     printf("%s\n", path);
-    FILE* file;
-    file = fopen(path, "r");
-    if (file == NULL) {
+    MappedFile file;
+    if (!file.open(path)) {
         printf("Cannot open the file !\n");
         return false;
     }
+    const char* data = file.data();
+    const char* end = data + file.size();
 
-    while (1) {
+    // chunks of about 1 MB, boundaries moved to the next line start
+    TileScheduler scheduler;
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(file.size() >> 20, 64 * (size_t)scheduler.getWorkerCount()));
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = data;
+    for (size_t c = 1; c < chunkCount; c++) {
+        const char* p = std::max(bounds[c - 1], data + file.size() * c / chunkCount);
+        const char* eol = (const char*)std::memchr(p, '\n', end - p);
+        bounds[c] = eol == nullptr ? end : eol + 1;
+    }
+    std::vector<OBJChunk> chunks(chunkCount);
+    scheduler.run((int)chunkCount, [&](int c, int) {
+        parseOBJChunk(bounds[c], bounds[c + 1], chunks[c]);
+    });
 
-        char lineHeader[64];
-        // read the first word of the line
-        int res = fscanf(file, "%s", lineHeader, 64);
-        //printf("%s\n", lineHeader);
-        if (res == EOF)
-            break;
-        if (strcmp(lineHeader, "v") == 0) {
-            Eigen::Vector3f vertex;
-            fscanf(file, "%f %f %f\n", &vertex(0), &vertex(1), &vertex(2));
-            out_vertices.push_back(vertex);
-            //printf("v\n");
-        }
-        else if (strcmp(lineHeader, "vt") == 0) {
-            Eigen::Vector2f uv;
-            fscanf(file, "%f %f\n", &uv(0), &uv(1));
-            out_uvs.push_back(uv);
-            //printf("vt\n");
+    // offsets of every chunk in the merged buffers
+    std::vector<size_t> vBase(chunkCount + 1, 0), vtBase(chunkCount + 1, 0), vnBase(chunkCount + 1, 0), iBase(chunkCount + 1, 0);
+    for (size_t c = 0; c < chunkCount; c++) {
+        if (chunks[c].error != nullptr) {
+            const char* eol = (const char*)std::memchr(chunks[c].error, '\n', end - chunks[c].error);
+            printf("Cannot parse line: %.*s\n", (int)((eol ? eol : end) - chunks[c].error), chunks[c].error);
+            return false;
         }
-        else if (strcmp(lineHeader, "vn") == 0) {
-            Eigen::Vector3f normal;
-            fscanf(file, "%f %f %f\n", &normal(0), &normal(1), &normal(2));
-            out_normals.push_back(normal);
-            //printf("vn\n");
-        }
-        else if (strcmp(lineHeader, "f") == 0) {
-            std::string vertex1, vertex2, vertex3;
-            unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-            if (matches != 9) {
-                printf("File can't be read by our simple parser : ( Try exporting with other options\n");
-                return false;
-            }
-            for (int j = 0; j < 3; j++)
-            {
-                out_v_index.push_back(vertexIndex[j]-1);
-                out_vt_index.push_back(uvIndex[j]-1);
-                out_vn_index.push_back(normalIndex[j]-1);
+        vBase[c + 1] = vBase[c] + chunks[c].vertices.size();
+        vtBase[c + 1] = vtBase[c] + chunks[c].uvs.size();
+        vnBase[c + 1] = vnBase[c] + chunks[c].normals.size();
+        iBase[c + 1] = iBase[c] + chunks[c].v_index.size();
+    }
+    size_t v0 = out_vertices.size(), vt0 = out_uvs.size(), vn0 = out_normals.size(), i0 = out_v_index.size();
+    out_vertices.resize(v0 + vBase[chunkCount]);
+    out_uvs.resize(vt0 + vtBase[chunkCount]);
+    out_normals.resize(vn0 + vnBase[chunkCount]);
+    out_v_index.resize(i0 + iBase[chunkCount]);
+    out_vt_index.resize(i0 + iBase[chunkCount]);
+    out_vn_index.resize(i0 + iBase[chunkCount]);
+
+    std::atomic<bool> inRange(true);
+    scheduler.run((int)chunkCount, [&](int c, int) {
+        const OBJChunk& chunk = chunks[c];
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), out_vertices.begin() + v0 + vBase[c]);
+        std::copy(chunk.uvs.begin(), chunk.uvs.end(), out_uvs.begin() + vt0 + vtBase[c]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), out_normals.begin() + vn0 + vnBase[c]);
+        // absolute corners count from the start of the file, relative ones from the start of the chunk
+        const int fileBase[3] = { (int)v0, (int)vt0, (int)vn0 };
+        const int chunkBase[3] = { (int)(v0 + vBase[c]), (int)(vt0 + vtBase[c]), (int)(vn0 + vnBase[c]) };
+        const int limit[3] = { (int)out_vertices.size(), (int)out_uvs.size(), (int)out_normals.size() };
+        std::vector<int>* out[3] = { &out_v_index, &out_vt_index, &out_vn_index };
+        const std::vector<int>* in[3] = { &chunk.v_index, &chunk.vt_index, &chunk.vn_index };
+        for (int k = 0; k < 3; k++) {
+            int* dst = out[k]->data() + i0 + iBase[c];
+            for (size_t i = 0; i < in[k]->size(); i++) {
+                int index = (*in[k])[i];
+                bool relative = (chunk.relative[i] & (1 << k)) != 0;
+                if (relative || index >= 0) {
+                    index += relative ? chunkBase[k] : fileBase[k];
+                    if (index < 0 || index >= limit[k])
+                        inRange = false;
+                }
+                dst[i] = index;
             }
-            
-            //printf("f\n");
         }
+    });
+    if (!inRange) {
+        printf("Face index out of range\n");
+        return false;
     }
-    
     return true;
 }
 
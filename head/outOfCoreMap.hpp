@@ -0,0 +1,447 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include "Eigen/Dense"
+#include "aabb.hpp"
+#include "kdTree.hpp"
+
+// Photon map kept on disk in spatially partitioned bricks.
+// Photons are binned by the Morton code of their position inside the scene bounds and
+// spilled to disk in chunks while tracing. balance() gathers every brick, balances it
+// on its own as a regular Map and writes it to the brick file in Morton order. A cell
+// holding more photons than a quarter of memory_budget is split into octants, again and
+// again, so no brick is larger than that. Queries page bricks in through an LRU cache that
+// never holds more than memory_budget bytes. A failed read or write is reported by failed().
+class OutOfCoreMap final : public PhotonMap {
+public:
+    struct Brick {
+        long long offset;                   // position of the first photon in the brick file
+        int count;                          // number of photons in the brick
+        AABB bounds;                        // tight bounds of the photons in the brick
+    };
+
+    OutOfCoreMap(                                                           // constructor
+        const std::string& path,
+        const AABB& scene_bounds,
+        Eigen::Vector3f light_power,
+        size_t memory_budget = size_t(1) << 30,
+        int brick_level = 4,
+        size_t spill_photons = size_t(1) << 20);
+    ~OutOfCoreMap() override;                                               // destructor
+    void store(                                                             // bin the photon into its brick, spill when staging is full
+        const Eigen::Vector3f& pos,
+        const Eigen::Vector3f& dir,
+        const Eigen::Vector3f& power) override;
+    void scale_photon_power(                                                // deferred, applied when a brick is paged in
+        float scale) override;
+    void balance() override;                                                // balance every brick and write the brick file and index
+    void locate(                                                            // k-nearest neighbor search across bricks
+        Nearest_photons* np) override;
+
+    const std::vector<Brick>& get_bricks() const;                           // top-level index retriever
+    size_t resident_bytes() const;                                          // memory currently held by the brick cache
+    size_t max_brick_photons() const;                                       // largest brick balance() writes
+    bool failed() const;                                                    // whether a spill or brick file access failed
+
+private:
+    struct SpillChunk {
+        int brick;                          // brick the chunk belongs to
+        long long offset;                   // position of the chunk in the spill file
+        int count;                          // number of photons in the chunk
+    };
+    struct CacheEntry {
+        int brick;
+        std::shared_ptr<Map> map;
+    };
+
+    uint32_t brick_index(const Eigen::Vector3f& pos) const;                 // Morton code of the brick holding pos
+    void flush_staging();                                                   // append all staged photons to the spill file
+    void spill(                                                             // append photons of a brick to the spill file
+        int brick,
+        std::vector<Photon>& buffer);
+    bool read_spill(                                                        // read photons back, false on a short read
+        long long offset,
+        int count,
+        Photon* out);
+    void write_bricks(                                                      // split the photons of chunks until they fit a brick
+        const std::vector<SpillChunk>& chunks,
+        int count,
+        int depth);
+    void write_brick(                                                       // balance the photons of chunks and append them as one brick
+        const std::vector<SpillChunk>& chunks,
+        int count);
+    std::shared_ptr<Map> fetch_brick(int brick);                            // page a brick in through the LRU cache
+
+    std::string path;                       // base path of the spill and brick files
+    AABB scene_bounds;                      // bounds used for the Morton partition
+    size_t memory_budget;                   // maximum bytes of resident bricks
+    int brick_level;                        // bricks per axis is 2^brick_level
+    size_t spill_photons;                   // staged photons that trigger a spill
+    size_t staged_photons;                  // photons currently staged in memory
+    bool balanced;                          // whether the brick file is ready for queries
+    bool io_failed;                         // a read or write of the spill or brick file came up short
+    float power_scale;                      // scale applied to the photon power of every paged brick
+
+    std::vector<std::vector<Photon>> staging;                               // per-brick staging buffers
+    std::vector<SpillChunk> spill_chunks;                                   // chunks written to the spill file
+    FILE* spill_file;
+    FILE* brick_file;
+
+    std::vector<Brick> bricks;                                              // top-level index, Morton ordered, empty bricks omitted
+
+    mutable std::mutex cache_mutex;                                         // guards the cache and the brick file
+    std::list<CacheEntry> lru;                                              // most recently used brick at the front
+    std::unordered_map<int, std::list<CacheEntry>::iterator> cache;
+    size_t cache_bytes;
+};
+
+// spread the lower 10 bits of v so that there are two zero bits between each
+inline uint32_t morton_spread(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+OutOfCoreMap::OutOfCoreMap(
+    const std::string& path,
+    const AABB& scene_bounds,
+    Eigen::Vector3f light_power,
+    size_t memory_budget,
+    int brick_level,
+    size_t spill_photons) :
+    PhotonMap(std::move(light_power)),
+    path(path),
+    scene_bounds(scene_bounds),
+    memory_budget(memory_budget),
+    brick_level(std::min(std::max(brick_level, 0), 10)),
+    spill_photons(spill_photons),
+    staged_photons(0),
+    balanced(false),
+    io_failed(false),
+    power_scale(1.0f),
+    brick_file(nullptr),
+    cache_bytes(0) {
+    staging.resize(size_t(1) << (3 * this->brick_level));
+    spill_file = fopen((path + ".spill").c_str(), "w+b");
+    if (spill_file == NULL)
+        printf("Cannot open the photon spill file !\n");
+}
+
+OutOfCoreMap::~OutOfCoreMap() {
+    if (spill_file != NULL) {
+        fclose(spill_file);
+        remove((path + ".spill").c_str());
+    }
+    if (brick_file != NULL) {
+        fclose(brick_file);
+        remove((path + ".bricks").c_str());
+    }
+}
+
+uint32_t OutOfCoreMap::brick_index(const Eigen::Vector3f& pos) const {
+    int res = 1 << brick_level;
+    Eigen::Vector3f rel = (pos - scene_bounds.lb).cwiseQuotient(scene_bounds.ub - scene_bounds.lb);
+    uint32_t code = 0;
+    for (int i = 0; i < 3; i++) {
+        int cell = std::min(std::max(int(rel[i] * res), 0), res - 1);       // photons outside the bounds go to the border bricks
+        code |= morton_spread(uint32_t(cell)) << i;
+    }
+    return code;
+}
+
+void OutOfCoreMap::store(
+    const Eigen::Vector3f& pos,
+    const Eigen::Vector3f& dir,
+    const Eigen::Vector3f& power) {
+    if (balanced || spill_file == NULL) {
+        STATS_INC(STAT_PHOTONS_DROPPED);
+        return;
+    }
+    STATS_INC(STAT_PHOTONS_STORED);
+
+    Photon p;
+    p.pos = pos;
+    p.dir = dir.normalized();
+    p.power = power;
+    staging[brick_index(pos)].push_back(p);
+    stored_photons++;
+
+    if (++staged_photons >= spill_photons)
+        flush_staging();
+}
+
+void OutOfCoreMap::scale_photon_power(
+    float scale) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    power_scale *= scale;
+    for (const CacheEntry& entry : lru)                                     // bricks already resident are scaled in place
+        entry.map->scale_photon_power(scale);
+}
+
+void OutOfCoreMap::flush_staging() {
+    for (int b = 0; b < (int)staging.size(); b++)
+        spill(b, staging[b]);
+    staged_photons = 0;
+}
+
+void OutOfCoreMap::spill(
+    int brick,
+    std::vector<Photon>& buffer) {
+    if (buffer.empty())
+        return;
+    fseek(spill_file, 0, SEEK_END);
+    SpillChunk chunk;
+    chunk.brick = brick;
+    chunk.offset = ftell(spill_file);
+    chunk.count = (int)buffer.size();
+    if (fwrite(buffer.data(), sizeof(Photon), buffer.size(), spill_file) != buffer.size())
+        io_failed = true;
+    spill_chunks.push_back(chunk);
+    std::vector<Photon>().swap(buffer);                                     // give the staging memory back
+}
+
+bool OutOfCoreMap::read_spill(
+    long long offset,
+    int count,
+    Photon* out) {
+    if (fseek(spill_file, offset, SEEK_SET) != 0 || fread(out, sizeof(Photon), count, spill_file) != size_t(count)) {
+        io_failed = true;
+        return false;
+    }
+    return true;
+}
+
+size_t OutOfCoreMap::max_brick_photons() const {
+    // balancing a brick takes about 2.5 times its photons, a quarter leaves room for the cache
+    return std::max<size_t>(memory_budget / (4 * sizeof(Photon)), 1);
+}
+
+void OutOfCoreMap::write_brick(
+    const std::vector<SpillChunk>& chunks,
+    int count) {
+    Map brick_map(count, light_power);
+    int filled = 0;
+    for (const SpillChunk& chunk : chunks) {
+        if (!read_spill(chunk.offset, chunk.count, &brick_map.photons[1 + filled]))
+            return;
+        filled += chunk.count;
+    }
+    brick_map.stored_photons = count;
+    for (int i = 1; i <= count; i++) {
+        brick_map.bbox_min = brick_map.bbox_min.cwiseMin(brick_map.photons[i].pos);
+        brick_map.bbox_max = brick_map.bbox_max.cwiseMax(brick_map.photons[i].pos);
+    }
+    Brick brick;
+    brick.count = count;
+    brick.bounds = AABB(brick_map.bbox_min, brick_map.bbox_max);
+    brick_map.balance();
+
+    fseek(brick_file, 0, SEEK_END);
+    brick.offset = ftell(brick_file);
+    if (fwrite(&brick_map.photons[1], sizeof(Photon), count, brick_file) != size_t(count))
+        io_failed = true;
+    bricks.push_back(brick);
+}
+
+void OutOfCoreMap::write_bricks(
+    const std::vector<SpillChunk>& chunks,
+    int count,
+    int depth) {
+    const int limit = (int)std::min<size_t>(max_brick_photons(), size_t(1) << 30);
+    if (count <= limit) {
+        write_brick(chunks, count);
+        return;
+    }
+
+    // pieces of at most limit photons, a spill chunk may be larger than a brick
+    std::vector<SpillChunk> pieces;
+    for (const SpillChunk& chunk : chunks)
+        for (int done = 0; done < chunk.count; done += limit)
+            pieces.push_back({ chunk.brick, chunk.offset + (long long)done * (long long)sizeof(Photon), std::min(limit, chunk.count - done) });
+
+    std::vector<Photon> buffer(limit);
+    Eigen::Vector3f lb = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+    Eigen::Vector3f ub = -lb;
+    for (const SpillChunk& piece : pieces) {                                // tight bounds of the photons, the first pass
+        if (!read_spill(piece.offset, piece.count, buffer.data()))
+            return;
+        for (int i = 0; i < piece.count; i++) {
+            lb = lb.cwiseMin(buffer[i].pos);
+            ub = ub.cwiseMax(buffer[i].pos);
+        }
+    }
+
+    if (depth >= 20 || (ub - lb).maxCoeff() <= 0.0f) {                     // photons on one point, cut the list into bricks
+        std::vector<SpillChunk> group;
+        int grouped = 0;
+        for (size_t k = 0; k < pieces.size(); k++) {
+            if (grouped + pieces[k].count > limit) {
+                write_brick(group, grouped);
+                group.clear();
+                grouped = 0;
+            }
+            group.push_back(pieces[k]);
+            grouped += pieces[k].count;
+        }
+        write_brick(group, grouped);
+        return;
+    }
+
+    // octants around the center in Morton order, staged in memory up to limit photons
+    Eigen::Vector3f center = 0.5f * (lb + ub);
+    std::vector<Photon> octants[8];
+    int octant_count[8] = {};
+    size_t before = spill_chunks.size();
+    int staged = 0;
+    auto flush_octants = [&]() {
+        for (int o = 0; o < 8; o++)
+            spill(o, octants[o]);
+        staged = 0;
+    };
+    for (const SpillChunk& piece : pieces) {
+        if (!read_spill(piece.offset, piece.count, buffer.data()))
+            return;
+        for (int i = 0; i < piece.count; i++) {
+            const Eigen::Vector3f& pos = buffer[i].pos;
+            int o = (pos.x() > center.x() ? 1 : 0) | (pos.y() > center.y() ? 2 : 0) | (pos.z() > center.z() ? 4 : 0);
+            octants[o].push_back(buffer[i]);
+            octant_count[o]++;
+            if (++staged >= limit)
+                flush_octants();
+        }
+    }
+    flush_octants();
+    std::vector<Photon>().swap(buffer);
+
+    // the new chunks were appended after before, tagged with their octant
+    std::vector<SpillChunk> children[8];
+    for (size_t k = before; k < spill_chunks.size(); k++)
+        children[spill_chunks[k].brick].push_back(spill_chunks[k]);
+    spill_chunks.resize(before);
+    for (int o = 0; o < 8; o++)
+        if (octant_count[o] > 0)
+            write_bricks(children[o], octant_count[o], depth + 1);
+}
+
+void OutOfCoreMap::balance() {
+    if (balanced || spill_file == NULL)
+        return;
+    flush_staging();
+
+    std::stable_sort(spill_chunks.begin(), spill_chunks.end(),             // group the chunks of each brick, Morton order
+        [](const SpillChunk& a, const SpillChunk& b) { return a.brick < b.brick; });
+
+    brick_file = fopen((path + ".bricks").c_str(), "w+b");
+    if (brick_file == NULL) {
+        printf("Cannot open the photon brick file !\n");
+        io_failed = true;
+        return;
+    }
+
+    std::vector<SpillChunk> cells;                                          // the chunks of the Morton cells, splitting appends more
+    cells.swap(spill_chunks);
+    size_t c = 0;
+    while (c < cells.size() && !io_failed) {
+        int b = cells[c].brick;
+        int count = 0;
+        size_t last = c;
+        while (last < cells.size() && cells[last].brick == b)
+            count += cells[last++].count;
+        std::vector<SpillChunk> cell(cells.begin() + c, cells.begin() + last);
+        write_bricks(cell, count, 0);                                       // only one brick is ever resident while balancing
+        c = last;
+    }
+    if (fflush(brick_file) != 0)
+        io_failed = true;
+    if (io_failed)
+        printf("Cannot write the photon brick file !\n");
+
+    fclose(spill_file);
+    remove((path + ".spill").c_str());
+    spill_file = NULL;
+    std::vector<SpillChunk>().swap(spill_chunks);
+    std::vector<std::vector<Photon>>().swap(staging);
+    balanced = true;
+}
+
+std::shared_ptr<Map> OutOfCoreMap::fetch_brick(int brick) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(brick);
+    if (it != cache.end()) {                                                // hit, move to the front
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->map;
+    }
+
+    const Brick& b = bricks[brick];
+    size_t bytes = size_t(b.count + 1) * sizeof(Photon);
+    while (!lru.empty() && cache_bytes + bytes > memory_budget) {           // evict least recently used bricks before reading
+        cache_bytes -= size_t(lru.back().map->max_photons + 1) * sizeof(Photon);
+        cache.erase(lru.back().brick);
+        lru.pop_back();                                                     // queries still holding the brick keep it alive
+    }
+
+    auto map = std::make_shared<Map>(b.count, light_power);
+    if (fseek(brick_file, b.offset, SEEK_SET) != 0 || fread(&map->photons[1], sizeof(Photon), b.count, brick_file) != size_t(b.count)) {
+        if (!io_failed)
+            printf("Cannot read the photon brick file !\n");
+        io_failed = true;
+        return std::make_shared<Map>(0, light_power);                       // no photons, not cached
+    }
+    map->stored_photons = b.count;
+    map->scale_photon_power(power_scale);
+
+    lru.push_front({ brick, map });
+    cache[brick] = lru.begin();
+    cache_bytes += bytes;
+    return map;
+}
+
+void OutOfCoreMap::locate(
+    Nearest_photons* np) {
+    if (!balanced)
+        return;
+
+    std::vector<std::pair<float, int>> order;                               // visit bricks nearest first so the heap shrinks quickly
+    order.reserve(bricks.size());
+    for (int b = 0; b < (int)bricks.size(); b++) {
+        const AABB& box = bricks[b].bounds;
+        Eigen::Vector3f d = (box.lb - np->pos).cwiseMax(np->pos - box.ub).cwiseMax(Eigen::Vector3f::Zero());
+        order.push_back({ d.squaredNorm(), b });
+    }
+    std::sort(order.begin(), order.end());
+
+    for (const auto& o : order) {
+        if (o.first >= np->dist[0])                                         // the remaining bricks cannot hold a closer photon
+            break;
+        std::shared_ptr<Map> map = fetch_brick(o.second);
+        int found = np->curr_num;
+        map->locate(np);
+        if (np->curr_num != found || np->built)                             // keep the brick alive while np points into it
+            np->pinned.push_back(map);
+    }
+}
+
+const std::vector<OutOfCoreMap::Brick>& OutOfCoreMap::get_bricks() const {
+    return bricks;
+}
+
+size_t OutOfCoreMap::resident_bytes() const {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache_bytes;
+}
+
+bool OutOfCoreMap::failed() const {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return io_failed;
+}
@@ -42,6 +42,12 @@ public:
 			interaction.surfaceColor = color;
 			interaction.uv[0] = q0;
 			interaction.uv[1] = q1;
+			if (texture >= 0)
+			{
+				interaction.texCoord = interaction.uv;
+				interaction.hasTexCoord = true;
+				interaction.uvPerUnit = 1.0f / std::sqrt(s0_len * s1_len);
+			}
 			return true;
 		}
 		return false;
@@ -3,152 +3,528 @@
 #include "integrator.hpp"
 #include "material.hpp"
 #include "kdTree.hpp"
+#include "tileScheduler.hpp"
+#include "gBuffer.hpp"
+#include "stats.hpp"
 #include <cmath>
-// #include <omp.h>
+#include <algorithm>
+#include <functional>
+#include <chrono>
 #define PHOTON_NUM 1000000
 class PhotonMappingIntegrator : public Integrator
 {
 public:
+	// side length of the square tiles the image is split into
+	int tileSize = 16;
+	// number of worker threads, 0 uses all hardware threads
+	int threadCount = 0;
+	// part of the image this process renders when a frame is split between processes:
+	// the tiles whose index modulo tileShardCount is tileShard, clipped to the crop
+	// window [x0, x1) x [y0, y1)
+	int tileShard = 0;
+	int tileShardCount = 1;
+	Eigen::Vector4i cropWindow = Eigen::Vector4i(0, 0, std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+	// average number of samples per pixel
+	int samples = 200;
+	// spend the sample budget where the per-pixel error estimate is high
+	bool adaptiveSampling = true;
+	// samples every pixel takes, and the most any pixel takes, when sampling adaptively
+	int minSamples = 16;
+	int maxSamples = 1024;
+	// a pixel stops once the standard error of the mean luminance around it drops below this fraction of the mean
+	float errorThreshold = 0.02f;
+	// samples taken between two convergence tests
+	int sampleBatch = 8;
+	// photons gathered per density estimate (the k of Nearest_photons) and the largest
+	// gather radius, for the global and the caustic map
+	int globalGatherCount = 1000;
+	float globalGatherRadius = 3.0f;
+	int causticGatherCount = 1000;
+	float causticGatherRadius = 2.0f;
+	// render in passes of passSamples samples per pixel until samples is reached or the
+	// time budget (seconds, 0 for none) runs out, calling onPass after each pass
+	bool progressive = false;
+	int passSamples = 4;
+	double timeBudget = 0.0;
+
+	// what a progressive pass did
+	struct PassReport
+	{
+		int pass;
+		// samples per pixel accumulated so far
+		int samples;
+		// wall-clock seconds of this pass and since the start of the render
+		double seconds;
+		double elapsed;
+		// true if the pass did not run because it would not fit in the time budget
+		bool skipped;
+	};
+
+	// diagnostic mode, record what every pixel costs in pixelCosts; showCostMap then puts
+	// one of the maps on the film. The counts need the render statistics compiled in,
+	// without them only the time map is filled.
+	bool costMaps = false;
+	enum CostMap { COST_TRAVERSAL, COST_TRIANGLES, COST_KNN, COST_TIME, COST_MAP_COUNT };
+	// per pixel: AABB tests plus grid cells visited, triangle tests, k-NN nodes visited, nanoseconds
+	std::vector<double> pixelCosts[COST_MAP_COUNT];
+
+	// called after every progressive pass, once the film holds the image so far
+	std::function<void(const PassReport&)> onPass;
+	// passes of the last progressive render, skipped ones included
+	std::vector<PassReport> passReports;
+
+	// running estimate of the sampled part of a pixel
+	struct PixelEstimate
+	{
+		Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+		double lumSum = 0.0;
+		double lumSqSum = 0.0;
+		int n = 0;
+
+		Eigen::Vector3f mean() const
+		{
+			return n > 0 ? Eigen::Vector3f(sum / (float)n) : Eigen::Vector3f::Zero();
+		}
+
+		// standard error of the mean luminance relative to the mean
+		float relativeError() const
+		{
+			if (n < 2)
+				return std::numeric_limits<float>::max();
+			double mean = lumSum / n;
+			double variance = std::max(0.0, (lumSqSum - mean * lumSum) / (n - 1));
+			return (float)(std::sqrt(variance / n) / std::max(mean, 1e-3));
+		}
+	};
+
+	// first hits of the last render
+	GBuffer gBuffer;
+	// sampled part of every pixel of the last render
+	std::vector<PixelEstimate> pixelEstimates;
+
 	PhotonMappingIntegrator(Scene* scene, Camera* camera)
 		: Integrator(scene, camera)
 	{
 	}
 
-	// main render loop
-	void render(Map &global,Map &caustic) override
+	// main render loop, the image is split into tiles shared out between worker threads
+	void render(PhotonMap &global,PhotonMap &caustic) override
 	{
-		
-		for (int dx = 0; dx < camera->m_Film.m_Res.x(); dx++)
+		if (progressive)
+		{
+			renderProgressive(global, caustic);
+			return;
+		}
+		resetCostMaps();
+		buildGBuffer();
+		int pixelCount = camera->m_Film.m_Res.x() * camera->m_Film.m_Res.y();
+		pixelEstimates.assign(pixelCount, PixelEstimate());
+		std::vector<Eigen::Vector3f> gathered(pixelCount);
+
+		// every pixel takes the minimum, or the fixed count when not sampling adaptively
+		forEachTile([&](int x0, int y0, int x1, int y1) {
+			for (int dy = y0; dy < y1; dy++)
+			{
+				for (int dx = x0; dx < x1; dx++)
+				{
+					measurePixel(dy * camera->m_Film.m_Res.x() + dx, [&]() {
+						gathered[dy * camera->m_Film.m_Res.x() + dx] = gatherPixel(dx, dy, global, caustic);
+						addSamples(dx, dy, adaptiveSampling ? minSamples : samples);
+					});
+				}
+			}
+		});
+
+		// the rest of the budget goes out in rounds to pixels whose error is still above the
+		// threshold, the noisiest first when the budget cannot cover all of them
+		if (adaptiveSampling)
 		{
-			for (int dy = 0; dy < camera->m_Film.m_Res.y(); dy++)
+			std::vector<std::pair<float, int>> noisy;
+			while (true)
 			{
-				Eigen::Vector3f L(0.0f, 0.0f, 0.0f);
-				Ray ray = camera->generateRay(dx, dy);
-				Interaction surfaceInteraction;
-				int samples = 200;
-				for (int i = 0; i < samples; ++i)
+				// pixels outside this process's tiles have no samples and no budget
+				long long budget = 0;
+				for (const PixelEstimate& e : pixelEstimates)
+					budget += e.n > 0 ? samples - e.n : 0;
+				if (budget < sampleBatch)
+					break;
+				noisy.clear();
+				for (int idx = 0; idx < pixelCount; idx++)
 				{
-					L += 3.0f * radiance(&surfaceInteraction, &ray);	//direct light
+					float error = neighbourhoodError(idx % camera->m_Film.m_Res.x(), idx / camera->m_Film.m_Res.x());
+					if (pixelEstimates[idx].n > 0 && pixelEstimates[idx].n < maxSamples && error >= errorThreshold)
+						noisy.push_back({ error, idx });
 				}
-				L = L / samples;
-
-				Ray specular_Ray = camera->generateRay(dx, dy);		//specular light
-				Interaction specular_SurfaceInteraction;
-				bool specular_interaction = scene->intersection(&specular_Ray, specular_SurfaceInteraction);
-				if (specular_interaction) {
-					if (((BSDF*)specular_SurfaceInteraction.material)->isSpecular == true) {
-						float materialPDF, lightPDF;
-						Eigen::Vector3f out_Dir, surface_Color, pos,surface_Norm, materialBRDF;
-						Eigen::Vector3f color(0, 0, 0);
-						Eigen::Vector3f beta(1, 1, 1);
-						surface_Norm = specular_SurfaceInteraction.normal;
-						specular_SurfaceInteraction.inputDir = -specular_Ray.m_Dir.normalized();
-						out_Dir = -specular_SurfaceInteraction.inputDir + 2.0f * specular_SurfaceInteraction.inputDir.dot(surface_Norm) * surface_Norm;
-						specular_Ray.m_Ori = specular_SurfaceInteraction.entryPoint;
-						specular_Ray.m_Dir = out_Dir;
-						for (int i = 0; i < 5; i++) {
-							if (scene->lights[0]->isHit(&specular_Ray, &specular_SurfaceInteraction))
-							{
-								color += beta.cwiseProduct(scene->lights[0]->m_Color);
-							}
-							specular_interaction = scene->intersection(&specular_Ray, specular_SurfaceInteraction);
-							if(specular_interaction){
-								color += beta.cwiseProduct(scene->lights[0]->m_Color).cwiseProduct(specular_SurfaceInteraction.surfaceColor);
-								specular_SurfaceInteraction.inputDir = -specular_Ray.m_Dir.normalized();
-								materialPDF = ((BSDF*)specular_SurfaceInteraction.material)->sample(specular_SurfaceInteraction);
-								materialBRDF = ((BSDF*)specular_SurfaceInteraction.material)->eval(specular_SurfaceInteraction);
-								if (materialPDF == 0.0f || (materialBRDF.x() == 0.0f && materialBRDF.y() == 0.0f && materialBRDF.z() == 0.0f))
-									break;
-								specular_Ray.m_Ori = specular_SurfaceInteraction.entryPoint;
-								specular_Ray.m_Dir = specular_SurfaceInteraction.outputDir;
-								beta = beta.cwiseProduct(materialBRDF) * std::fabsf(specular_SurfaceInteraction.outputDir.dot(specular_SurfaceInteraction.normal)) / materialPDF;
-							}
-							else
-								break; 
-						}
-						L += 0.01f * color;
+				if (noisy.empty())
+					break;
+				size_t count = std::min(noisy.size(), (size_t)(budget / sampleBatch));
+				std::partial_sort(noisy.begin(), noisy.begin() + count, noisy.end(),
+					[](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; });
+				const int chunk = 64;
+				TileScheduler scheduler(threadCount);
+				scheduler.run((int)((count + chunk - 1) / chunk), [&](int job, int) {
+					for (size_t k = (size_t)job * chunk; k < std::min(count, (size_t)(job + 1) * chunk); k++)
+					{
+						int idx = noisy[k].second;
+						measurePixel(idx, [&]() {
+							addSamples(idx % camera->m_Film.m_Res.x(), idx / camera->m_Film.m_Res.x(),
+								std::min(sampleBatch, maxSamples - pixelEstimates[idx].n));
+						});
 					}
+				});
+			}
+		}
+
+		for (int idx = 0; idx < pixelCount; idx++)
+			setFilmPixel(idx % camera->m_Film.m_Res.x(), idx / camera->m_Film.m_Res.x(), gathered[idx]);
+	}
+
+	// accumulate the image in passes of passSamples samples per pixel, writing the film after
+	// each one. A pass that would not finish inside the time budget, judged by the time per
+	// sample of the previous pass, is skipped along with all later ones, so the render stops
+	// cleanly on a complete pass instead of leaving some pixels with fewer samples than others.
+	void renderProgressive(PhotonMap &global, PhotonMap &caustic)
+	{
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point start = Clock::now();
+		int pixelCount = camera->m_Film.m_Res.x() * camera->m_Film.m_Res.y();
+		int passCount = std::max(1, (samples + passSamples - 1) / passSamples);
+		pixelEstimates.assign(pixelCount, PixelEstimate());
+		std::vector<Eigen::Vector3f> gathered(pixelCount);
+		passReports.clear();
+		resetCostMaps();
+
+		// the first hits and the photon gather are done once before the passes, so that the
+		// budget test judges a pass by its sampling work alone
+		buildGBuffer();
+		forEachTile([&](int x0, int y0, int x1, int y1) {
+			for (int dy = y0; dy < y1; dy++)
+				for (int dx = x0; dx < x1; dx++)
+				{
+					int idx = dy * camera->m_Film.m_Res.x() + dx;
+					measurePixel(idx, [&]() { gathered[idx] = gatherPixel(dx, dy, global, caustic); });
 				}
+		});
 
-				Ray ray_photon = camera->generateRay(dx, dy);
-				Interaction surfaceInteraction_photon;
-				bool intersection_photon = scene->intersection(&ray_photon,surfaceInteraction_photon);
-				Eigen::Vector3f irradiancePhoton(0, 0, 0);
-				Eigen::Vector3f surfaceNormPhoton = surfaceInteraction_photon.normal.normalized();
-				Eigen::Vector3f surfaceColorPhoton = surfaceInteraction_photon.surfaceColor;
-				surfaceInteraction_photon.inputDir = -ray_photon.m_Dir;
-				((BSDF*)surfaceInteraction_photon.material)->sample(surfaceInteraction_photon);
-				Eigen::Vector3f BRDF = ((BSDF*)surfaceInteraction_photon.material)->eval(surfaceInteraction_photon);
-				int photon_num = global.stored_photons;
-				if (intersection_photon) {
-					if (((BSDF*)surfaceInteraction_photon.material)->isSpecular != true) {
-						Nearest_photons np(1000,surfaceInteraction_photon.entryPoint,3);
-						global.locate_photons(&np, 1);
-						Photon** photons = np.get_photons();
-						for (int i = 1;i <= np.curr_num;i++) {
-							if (photons[i]->dir.dot(surfaceNormPhoton) > 0) {
-								Eigen::Vector3f input_dir = photons[i]->dir.normalized();
-								irradiancePhoton += surfaceColorPhoton * (input_dir.dot(surfaceNormPhoton.normalized()));
-							}
-							irradiancePhoton *= (1 / M_PIf) * (1 / np.dist[0])/photon_num;
-							L += 20.0f * irradiancePhoton.cwiseProduct(BRDF);
-						}
-					}
+		double secondsPerSample = 0.0;
+		for (int pass = 0; pass < passCount; pass++)
+		{
+			PassReport report = { pass, pass * passSamples, 0.0, 0.0, false };
+			int count = std::min(passSamples, samples - pass * passSamples);
+			Clock::time_point passStart = Clock::now();
+			report.elapsed = std::chrono::duration<double>(passStart - start).count();
+			if (timeBudget > 0.0 && pass > 0 && report.elapsed + secondsPerSample * count > timeBudget)
+			{
+				for (; pass < passCount; pass++)
+				{
+					report.pass = pass;
+					report.skipped = true;
+					passReports.push_back(report);
 				}
+				break;
+			}
 
-				Ray ray_caustic = camera->generateRay(dx, dy);
-				Interaction surfaceInteraction_caustic;
-				bool intersection_caustic = scene->intersection(&ray_caustic, surfaceInteraction_caustic);
-				Eigen::Vector3f irradianceCaustics(0, 0, 0);
-				Eigen::Vector3f surfaceNormCaustics = surfaceInteraction_caustic.normal.normalized();
-				Eigen::Vector3f	surfaceColorCaustics = surfaceInteraction_caustic.surfaceColor;
-				surfaceInteraction_caustic.inputDir = -ray_caustic.m_Dir;
-				((BSDF*)surfaceInteraction_caustic.material)->sample(surfaceInteraction_caustic);
-				Eigen::Vector3f BRDF_caustic = ((BSDF*)surfaceInteraction_caustic.material)->eval(surfaceInteraction_caustic);
-				int photon_num1 = caustic.stored_photons;
-				if (intersection_caustic) {
-					if (((BSDF*)surfaceInteraction_caustic.material)->isSpecular != true) {
-						Nearest_photons np1(1000, surfaceInteraction_caustic.entryPoint, 2);
-						caustic.locate_photons(&np1, 1);
-						Photon** photons_Caustic = np1.get_photons();
-						for (int i = 1;i <= np1.curr_num;i++) {
-							if (photons_Caustic[i]->dir.dot(surfaceNormCaustics) > 0) {
-								Eigen::Vector3f input_dir = photons_Caustic[i]->dir.normalized();
-								irradianceCaustics += surfaceColorCaustics * (input_dir.dot(surfaceNormCaustics.normalized()));
-							}
-						}
-						irradianceCaustics *= (1 / M_PIf) * (1 / np1.dist[0])/ photon_num1;
-						L += 20.0f * irradianceCaustics.cwiseProduct(BRDF_caustic);
+			forEachTile([&](int x0, int y0, int x1, int y1) {
+				for (int dy = y0; dy < y1; dy++)
+				{
+					for (int dx = x0; dx < x1; dx++)
+					{
+						int idx = dy * camera->m_Film.m_Res.x() + dx;
+						measurePixel(idx, [&]() { addSamples(dx, dy, count); });
+						setFilmPixel(dx, dy, gathered[idx]);
 					}
 				}
+			});
 
-				camera->setPixel(dx, dy, L);
+			Clock::time_point passEnd = Clock::now();
+			report.seconds = std::chrono::duration<double>(passEnd - passStart).count();
+			secondsPerSample = report.seconds / count;
+			report.samples = pass * passSamples + count;
+			report.elapsed = std::chrono::duration<double>(passEnd - start).count();
+			passReports.push_back(report);
+			if (onPass)
+				onPass(report);
+		}
+	}
+
+	// call tileFunc(x0, y0, x1, y1) for every tile of the film this process renders, on the worker threads
+	void forEachTile(const std::function<void(int, int, int, int)>& tileFunc)
+	{
+		int resX = camera->m_Film.m_Res.x();
+		int resY = camera->m_Film.m_Res.y();
+		int tilesX = (resX + tileSize - 1) / tileSize;
+		int tilesY = (resY + tileSize - 1) / tileSize;
+		std::vector<int> tiles;
+		for (int tile = tileShard; tile < tilesX * tilesY; tile += tileShardCount)
+			tiles.push_back(tile);
+		TileScheduler scheduler(threadCount);
+		scheduler.run((int)tiles.size(), [&](int job, int) {
+			int x0 = (tiles[job] % tilesX) * tileSize;
+			int y0 = (tiles[job] / tilesX) * tileSize;
+			int x1 = std::min({ x0 + tileSize, resX, cropWindow[2] });
+			int y1 = std::min({ y0 + tileSize, resY, cropWindow[3] });
+			x0 = std::max(x0, cropWindow[0]);
+			y0 = std::max(y0, cropWindow[1]);
+			if (x0 < x1 && y0 < y1)
+				tileFunc(x0, y0, x1, y1);
+		});
+	}
+
+	// visibility pass, trace the primary ray of every pixel once
+	void buildGBuffer()
+	{
+		gBuffer.resize(camera->m_Film.m_Res);
+		forEachTile([&](int x0, int y0, int x1, int y1) {
+			for (int dy = y0; dy < y1; dy++)
+			{
+				for (int dx = x0; dx < x1; dx++)
+				{
+					measurePixel(dy * camera->m_Film.m_Res.x() + dx, [&]() {
+						Ray ray = camera->generateRay(dx, dy);
+						STATS_INC(STAT_CAMERA_RAYS);
+						Interaction& hit = gBuffer.at(dx, dy);
+						if (!scene->intersection(&ray, hit))
+							hit.material = NULL;
+						hit.inputDir = -ray.m_Dir;
+					});
+				}
 			}
+		});
+	}
+
+	void resetCostMaps()
+	{
+		for (std::vector<double>& map : pixelCosts)
+			map.assign(costMaps ? camera->m_Film.m_Res.x() * camera->m_Film.m_Res.y() : 0, 0.0);
+	}
+
+	// run @work for pixel @idx, adding what it costs to the cost maps when they are on
+	// a pixel is only ever worked on by one thread at a time, so the maps need no locking
+	template <class Work>
+	void measurePixel(int idx, const Work& work)
+	{
+		if (!costMaps)
+		{
+			work();
+			return;
 		}
-		
+		uint64_t traversal = threadStat(STAT_AABB_TESTS) + threadStat(STAT_GRID_CELLS);
+		uint64_t triangles = threadStat(STAT_TRIANGLE_TESTS);
+		uint64_t knn = threadStat(STAT_KNN_NODES);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		work();
+		pixelCosts[COST_TIME][idx] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		pixelCosts[COST_TRAVERSAL][idx] += (double)(threadStat(STAT_AABB_TESTS) + threadStat(STAT_GRID_CELLS) - traversal);
+		pixelCosts[COST_TRIANGLES][idx] += (double)(threadStat(STAT_TRIANGLE_TESTS) - triangles);
+		pixelCosts[COST_KNN][idx] += (double)(threadStat(STAT_KNN_NODES) - knn);
 	}
 
-	// radiance of a specific point
-	Eigen::Vector3f radiance(Interaction* interaction, Ray* ray) override
+	// put cost map @map on the film as a heat map, black through blue, red and yellow to
+	// white at the 99th percentile of the rendered pixels, so a few extreme pixels do not
+	// wash out the rest and the pixels a crop or other shards leave out do not set the scale
+	// colours are stored linear, so the usual sRGB output shows the ramp as designed
+	// return the cost at the top of the scale
+	double showCostMap(int map)
+	{
+		const std::vector<double>& costs = pixelCosts[map];
+		if (costs.empty())
+			return 0.0;
+		std::vector<double> sorted;
+		for (int idx = 0; idx < (int)costs.size(); idx++)
+			if (pixelCosts[COST_TIME][idx] > 0.0)
+				sorted.push_back(costs[idx]);
+		if (sorted.empty())
+			return 0.0;
+		size_t top = std::min(sorted.size() - 1, (size_t)(0.99 * sorted.size()));
+		std::nth_element(sorted.begin(), sorted.begin() + top, sorted.end());
+		double scale = std::max(sorted[top], 1e-9);
+
+		static const Eigen::Vector3f ramp[] = {
+			{ 0.0f, 0.0f, 0.0f }, { 0.1f, 0.1f, 0.6f }, { 0.8f, 0.1f, 0.2f }, { 1.0f, 0.8f, 0.0f }, { 1.0f, 1.0f, 1.0f }
+		};
+		const int segments = sizeof(ramp) / sizeof(ramp[0]) - 1;
+		int resX = camera->m_Film.m_Res.x();
+		for (int idx = 0; idx < (int)costs.size(); idx++)
+		{
+			float t = (float)std::min(costs[idx] / scale, 1.0) * segments;
+			int s = std::min((int)t, segments - 1);
+			Eigen::Vector3f c = ramp[s] + (t - s) * (ramp[s + 1] - ramp[s]);
+			camera->setPixel(idx % resX, idx / resX, c.array().pow(2.2f).matrix());
+		}
+		return scale;
+	}
+
+	// one Monte Carlo sample of the light reaching a pixel directly or through specular bounces
+	Eigen::Vector3f samplePixel(int dx, int dy)
+	{
+		Ray ray = camera->generateRay(dx, dy);
+		Interaction surfaceInteraction = gBuffer.at(dx, dy);
+		Eigen::Vector3f L = radiance(&surfaceInteraction, &ray);	//direct light
+		if (gBuffer.isHit(dx, dy) && ((BSDF*)surfaceInteraction.material)->isSpecular == true)
+			L += specularRadiance(surfaceInteraction);	//specular light
+		return L;
+	}
+
+	// add @count samples to the estimate of a pixel
+	void addSamples(int dx, int dy, int count)
+	{
+		PixelEstimate& e = pixelEstimates[dy * camera->m_Film.m_Res.x() + dx];
+		for (int i = 0; i < count; i++)
+		{
+			Eigen::Vector3f L = samplePixel(dx, dy);
+			double y = 0.2126 * L.x() + 0.7152 * L.y() + 0.0722 * L.z();
+			e.sum += L;
+			e.lumSum += y;
+			e.lumSqSum += y * y;
+			e.n++;
+		}
+	}
+
+	// write a pixel to the film, the photon gather is a fixed term added to every sample
+	void setFilmPixel(int dx, int dy, const Eigen::Vector3f& gathered)
+	{
+		const PixelEstimate& e = pixelEstimates[dy * camera->m_Film.m_Res.x() + dx];
+		camera->m_Film.setAccumulated(dx, dy, e.sum + (float)e.n * gathered, e.n);
+	}
+
+	// largest relative error in the 3x3 neighbourhood of a pixel, so a pixel that saw no
+	// light by chance inside a noisy penumbra is not taken for converged
+	float neighbourhoodError(int dx, int dy) const
+	{
+		float error = 0.0f;
+		for (int y = std::max(dy - 1, 0); y <= std::min(dy + 1, camera->m_Film.m_Res.y() - 1); y++)
+			for (int x = std::max(dx - 1, 0); x <= std::min(dx + 1, camera->m_Film.m_Res.x() - 1); x++)
+				if (pixelEstimates[y * camera->m_Film.m_Res.x() + x].n > 0)	// skip pixels other processes render
+					error = std::max(error, pixelEstimates[y * camera->m_Film.m_Res.x() + x].relativeError());
+		return error;
+	}
+
+	// light reflected by a diffuse first hit, estimated from the photon maps
+	Eigen::Vector3f gatherPixel(int dx, int dy, PhotonMap &global, PhotonMap &caustic)
 	{
-		//// TODO: Calculate color here
 		Eigen::Vector3f L(0.0f, 0.0f, 0.0f);
-		//Eigen::Vector3f beta(1.0f, 1.0f, 1.0f);
-		bool specularBounce = false;
-		Ray currRay = *ray;
-		Interaction surfaceInteraction;
-		bool intersection = scene->intersection(&currRay, surfaceInteraction);
-		if (scene->lights[0]->isHit(&currRay, &surfaceInteraction) == true)
-			L += scene->lights[0]->m_Color;
-		if (intersection) {
-			Eigen::Vector3f lightPos, lightColor, materialBRDF;
-			float lightPDF, materialPDF;
-			lightColor = scene->lights[0]->SampleSurfacePos(lightPos, lightPDF);
-			Eigen::Vector3f lightDir = lightPos - surfaceInteraction.entryPoint;
-			Ray shadowRay(surfaceInteraction.entryPoint, lightDir, 1e-3f, lightDir.norm());
-			if (!scene->intersection(&shadowRay))
-				L += (lightColor.cwiseProduct(surfaceInteraction.surfaceColor)) / lightPDF;
-			return 0.1f * L;
+		if (!gBuffer.isHit(dx, dy))
+			return L;
+		Interaction& surfaceInteraction = gBuffer.at(dx, dy);
+		if (((BSDF*)surfaceInteraction.material)->isSpecular != true)
+		{
+			L += photonRadiance(global, surfaceInteraction, globalGatherCount, globalGatherRadius);		//indirect light from the global map
+			L += photonRadiance(caustic, surfaceInteraction, causticGatherCount, causticGatherRadius);	//caustics
+		}
+		return L;
+	}
+
+	// light reaching the camera through a chain of specular bounces starting at a specular first hit
+	Eigen::Vector3f specularRadiance(const Interaction& firstHit)
+	{
+		float materialPDF;
+		Eigen::Vector3f materialBRDF;
+		Eigen::Vector3f color(0, 0, 0);
+		Eigen::Vector3f beta(1, 1, 1);
+		Interaction specular_SurfaceInteraction = firstHit;
+		materialPDF = ((BSDF*)specular_SurfaceInteraction.material)->sample(specular_SurfaceInteraction);
+		materialBRDF = ((BSDF*)specular_SurfaceInteraction.material)->eval(specular_SurfaceInteraction);
+		beta = materialBRDF * std::fabs(specular_SurfaceInteraction.outputDir.dot(specular_SurfaceInteraction.normal)) / materialPDF;
+		Ray specular_Ray(specular_SurfaceInteraction.entryPoint, specular_SurfaceInteraction.outputDir);
+		// the pixel's ray cone continues through the bounces, mirrors keep its spread
+		specular_Ray.m_Spread = camera->pixelSpread();
+		specular_Ray.m_Width = specular_Ray.m_Spread * firstHit.entryDist;
+		bool bounceSpecular = true;
+		for (int i = 0; i < 5; i++) {
+			STATS_INC(STAT_SPECULAR_RAYS);
+			bool specular_interaction = scene->intersection(&specular_Ray, specular_SurfaceInteraction);
+			// after a diffuse bounce the light sample below already counted the light
+			if (specular_SurfaceInteraction.lightId != -1 && bounceSpecular)
+			{
+				color += beta.cwiseProduct(scene->lights[specular_SurfaceInteraction.lightId]->m_Color);
+			}
+			if(specular_interaction){
+				specular_SurfaceInteraction.inputDir = -specular_Ray.m_Dir.normalized();
+				color += beta.cwiseProduct(directLight(specular_SurfaceInteraction));
+				bounceSpecular = ((BSDF*)specular_SurfaceInteraction.material)->isSpecular;
+				materialPDF = ((BSDF*)specular_SurfaceInteraction.material)->sample(specular_SurfaceInteraction);
+				materialBRDF = ((BSDF*)specular_SurfaceInteraction.material)->eval(specular_SurfaceInteraction);
+				if (materialPDF == 0.0f || (materialBRDF.x() == 0.0f && materialBRDF.y() == 0.0f && materialBRDF.z() == 0.0f))
+					break;
+				specular_Ray.m_Width = specular_Ray.footprint(specular_SurfaceInteraction.entryDist);
+				specular_Ray.m_Ori = specular_SurfaceInteraction.entryPoint;
+				specular_Ray.m_Dir = specular_SurfaceInteraction.outputDir;
+				beta = beta.cwiseProduct(materialBRDF) * std::fabs(specular_SurfaceInteraction.outputDir.dot(specular_SurfaceInteraction.normal)) / materialPDF;
+			}
+			else
+				break; 
 		}
+		return color;
+	}
+
+	// density estimate of the radiance reflected by a diffuse point from the k nearest photons
+	// photon power is already normalized by the number of emitted photons
+	Eigen::Vector3f photonRadiance(PhotonMap& map, Interaction& surfaceInteraction, int k, float maxDist)
+	{
+		Eigen::Vector3f flux(0.0f, 0.0f, 0.0f);
+		Eigen::Vector3f N = surfaceInteraction.normal.normalized();
+		Nearest_photons np(k, surfaceInteraction.entryPoint, maxDist);
+		map.locate(&np);
+		STATS_ADD(STAT_PHOTONS_GATHERED, np.curr_num);
+		if (np.curr_num == 0)
+			return flux;
+		Photon** photons = np.get_photons();
+		for (int i = 1; i <= np.curr_num; i++) {
+			if (photons[i]->dir.dot(N) > 0)
+				flux += photons[i]->power;
+		}
+		Eigen::Vector3f BRDF = surfaceInteraction.surfaceColor / M_PIf;
+		return BRDF.cwiseProduct(flux) / (M_PIf * np.dist[0]);
+	}
+
+	// radiance of a specific point
+	// @interaction is the first hit of @ray, as stored in the G-buffer
+	Eigen::Vector3f radiance(Interaction* interaction, Ray* /*ray*/) override
+	{
+		Eigen::Vector3f L(0.0f, 0.0f, 0.0f);
+		if (interaction->lightId != -1)
+			L += scene->lights[interaction->lightId]->m_Color;
+		if (interaction->material != NULL)
+			L += directLight(*interaction);
+		return L;
+	}
+
+	// one sample of the light arriving straight from a light and reflected towards
+	// @interaction.inputDir: a point on a light picked by the hierarchy, weighted by the BSDF,
+	// the cosine at the light and the inverse squared distance
+	// specular surfaces reflect no light from a sampled point, only along their delta directions
+	Eigen::Vector3f directLight(const Interaction& interaction)
+	{
+		Eigen::Vector3f L(0.0f, 0.0f, 0.0f);
+		if (((BSDF*)interaction.material)->isSpecular)
+			return L;
+		float lightPickPDF;
+		Light* light = scene->sampleLight(interaction.entryPoint, interaction.normal, lightPickPDF);
+		if (light == nullptr)
+			return L;
+		Eigen::Vector3f lightPos, lightNormal;
+		float lightPDF;
+		Eigen::Vector3f lightColor = light->SampleEmissionPos(lightPos, lightNormal, lightPDF);
+		Eigen::Vector3f lightDir = lightPos - interaction.entryPoint;
+		float dist = lightDir.norm();
+		if (lightPDF <= 0.0f || dist <= 2e-3f)
+			return L;
+		lightDir /= dist;
+		// lights emit on the side of their normal only
+		float cosLight = -lightDir.dot(lightNormal);
+		if (cosLight <= 0.0f)
+			return L;
+		// light arrives along lightDir and leaves towards the viewer, eval holds the cosine at the surface
+		Interaction lit = interaction;
+		lit.outputDir = interaction.inputDir;
+		lit.inputDir = lightDir;
+		Eigen::Vector3f f = ((BSDF*)interaction.material)->eval(lit);
+		if (f.isZero())
+			return L;
+		Ray shadowRay(interaction.entryPoint, lightDir, 1e-3f, dist - 1e-3f);
+		STATS_INC(STAT_SHADOW_RAYS);
+		if (!scene->intersection(&shadowRay))
+			L = lightColor.cwiseProduct(f) * cosLight / (dist * dist * lightPDF * lightPickPDF);
+		return L;
 	}
 };
\ No newline at end of file
@@ -4,226 +4,355 @@
 // #include <omp.h>
 #include <cstdlib>
 #include <ctime>
+#include <algorithm>
+#include <chrono>
 #include "material.hpp"
 #include "light.hpp"
 #include "scene.hpp"
 #include "kdTree.hpp"
-//return number of photons
-int globalPhotonTracing(Scene* scene, Map &photonMap, int n)
+#include "sampler.hpp"
+
+// Russian roulette at a diffuse surface as in Jensen's method. The photon survives with
+// the probability that the surface reflects its power, and the survivor's power is
+// rescaled so that its expected value is the reflected power.
+bool diffuseRussianRoulette(const Eigen::Vector3f& albedo, Eigen::Vector3f& power)
 {
-	Light* light = scene->lights[0];
-	int count = 0;
-	for (int i = 0; i < n; ++i)
+	float maxPower = power.maxCoeff();
+	if (maxPower <= 0.0f)
+		return false;
+	float reflectProb = std::fmin(albedo.cwiseProduct(power).maxCoeff() / maxPower, 1.0f);
+	float rand = randomFloat();
+	if (rand >= reflectProb)
+		return false;
+	power = power.cwiseProduct(albedo) / reflectProb;
+	return true;
+}
+
+// Follow a photon through a specular surface, scaling its power by the BSDF weight
+// Return false if the path carries no more power
+bool specularBounce(Interaction& surfaceInteraction, Ray& currRay, Eigen::Vector3f& power)
+{
+	surfaceInteraction.inputDir = -currRay.m_Dir;
+	float pdf = ((BSDF*)surfaceInteraction.material)->sample(surfaceInteraction);
+	if (pdf == 0.0f)
+		return false;
+	Eigen::Vector3f bsdf = ((BSDF*)surfaceInteraction.material)->eval(surfaceInteraction);
+	power = power.cwiseProduct(bsdf) * std::fabs(surfaceInteraction.outputDir.dot(surfaceInteraction.normal)) / pdf;
+	currRay.m_Ori = surfaceInteraction.entryPoint;
+	currRay.m_Dir = surfaceInteraction.outputDir;
+	return true;
+}
+
+//true once @timeBudget seconds (0 for no limit) have passed since @start, checked
+//every 256 emissions so tracing stops on time without reading the clock per photon
+inline bool photonBudgetExpired(std::chrono::steady_clock::time_point start, double timeBudget, int emitted)
+{
+	return timeBudget > 0.0 && (emitted & 255) == 0 &&
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeBudget;
+}
+
+//sample a photon leaving a light picked proportionally to its power
+//return false if the sample carries no power
+bool emitPhoton(Scene* scene, Eigen::Vector3f& ori, Eigen::Vector3f& dir, Eigen::Vector3f& power)
+{
+	STATS_INC(STAT_PHOTONS_EMITTED);
+	float lightPickPDF, lightPosPDF, lightDirPDF;
+	Light* light = scene->sampleEmitter(lightPickPDF);
+	if (light == nullptr)
+		return false;
+	Eigen::Vector3f normal;
+	Eigen::Vector3f lightColor = light->SampleEmissionPos(ori, normal, lightPosPDF);
+	if (lightPosPDF == 0.0f)
+		return false;
+	dir = light->SampleLightDir(normal, lightDirPDF).normalized();
+	float cosLight = normal.dot(dir);
+	if (cosLight <= 0.0f || lightDirPDF == 0.0f)
+		return false;
+	power = lightColor * cosLight / (lightPickPDF * lightPosPDF * lightDirPDF);
+	return true;
+}
+
+//bounding spheres of the specular shapes, the targets of caustic photons
+struct CausticTargets
+{
+	std::vector<Eigen::Vector3f> center;
+	std::vector<float> radius;
+
+	explicit CausticTargets(Scene* scene)
 	{
-		bool firstHit = true;
-		float lightPosPDF, lightDirPDF;
-		Eigen::Vector3f lightPos, lightColor, lightDir;
-		lightColor = light->SampleSurfacePos(lightPos, lightPosPDF);
-		lightDir = light->SampleLightDir(lightDirPDF);
-		Ray currRay(lightPos, lightDir);
-		Interaction surfaceInteraction;
-		while (1)
+		for (Shape* shape : scene->shapes)
 		{
-			bool intersection = scene->intersection(&currRay, surfaceInteraction);
-			if (intersection == false)
-				break;
-			if (((BSDF*)surfaceInteraction.material)->isSpecular == true)
-			{
-				firstHit = false;
-				surfaceInteraction.inputDir = -currRay.m_Dir;
-				//((BSDF*)surfaceInteraction.material)->sample(surfaceInteraction);
-				Eigen::Vector3f L = surfaceInteraction.inputDir.normalized();
-				Eigen::Vector3f N = surfaceInteraction.normal.normalized();
-				float LdotN = L.dot(N);
-				if (LdotN >= 0)
-				{
-					float n1 = 1.0f;
-					float n2 = 1.5f;
-					float cos1 = LdotN / (L.norm() * N.norm());
-					float sin1 = sqrtf(1 - cos1 * cos1);
-					float sin2 = n1 * sin1 / n2;
-					float angle1 = acosf(cos1);
-					float angle2 = asinf(sin2);
-					float reflectRatio = 0.5f * ((sinf(angle1 - angle2) * sinf(angle1 - angle2)) / (sinf(angle1 + angle2) * sinf(angle1 + angle2)) + (tanf(angle1 - angle2) * tanf(angle1 - angle2)) / (tanf(angle1 + angle2) * tanf(angle1 + angle2)));
-					float rand = (float)std::rand() / (float)RAND_MAX;
-					if (rand < reflectRatio) //reflect
-					{
-						Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-						surfaceInteraction.outputDir = outputDir.normalized();
-					}
-					else //refract
-					{
-						Eigen::Vector3f outputDir = (n1 * LdotN / n2 - sqrtf(1 - n1 * n1 * (1 - LdotN * LdotN) / (n2 * n2))) * N - n1 * L / n2;
-						surfaceInteraction.outputDir = outputDir.normalized();
-					}
-				}
-				else
-				{
-					float n1 = 1.5f;
-					float n2 = 1.0f;
-					float temp = 1 - n1 * n1 * (1 - LdotN * LdotN) / (n2 * n2);
-					if (temp < 0) //total internal reflection
-					{
-						Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-						surfaceInteraction.outputDir = outputDir.normalized();
-					}
-					else
-					{
-						LdotN = -LdotN;
-						N = -N;
-						float cos1 = LdotN / (L.norm() * N.norm());
-						float sin1 = sqrtf(1 - cos1 * cos1);
-						float sin2 = n1 * sin1 / n2;
-						float angle1 = acosf(cos1);
-						float angle2 = asinf(sin2);
-						float reflectRatio = 0.5f * ((sinf(angle1 - angle2) * sinf(angle1 - angle2)) / (sinf(angle1 + angle2) * sinf(angle1 + angle2)) + (tanf(angle1 - angle2) * tanf(angle1 - angle2)) / (tanf(angle1 + angle2) * tanf(angle1 + angle2)));
-						float rand = (float)std::rand() / (float)RAND_MAX;
-						if (rand < reflectRatio) //reflect
-						{
-							Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-							surfaceInteraction.outputDir = outputDir.normalized();
-						}
-						else //refract
-						{
-							Eigen::Vector3f outputDir = (n1 * LdotN / n2 - sqrtf(temp)) * N - n1 * L / n2;
-							surfaceInteraction.outputDir = outputDir.normalized();
-						}
-					}
-				}
-				currRay.m_Ori = surfaceInteraction.entryPoint;
-				currRay.m_Dir = surfaceInteraction.outputDir;
-			}
-			else
+			if (shape->material != nullptr && shape->material->isSpecular)
 			{
-				surfaceInteraction.inputDir = -currRay.m_Dir;
-				((BSDF*)surfaceInteraction.material)->sample(surfaceInteraction);
-				currRay.m_Ori = surfaceInteraction.entryPoint;
-				currRay.m_Dir = surfaceInteraction.outputDir;
-				if (firstHit)
-					firstHit = false;
-				else 
-				{
-					photonMap.store(surfaceInteraction.entryPoint, surfaceInteraction.inputDir);
-					++count;
-				}
-				float rand = (float)std::rand() / (float)RAND_MAX;
-				if (rand > 0.95f)
-					break;
+				center.push_back(shape->m_BoundingBox.getCenter());
+				radius.push_back(0.5f * shape->m_BoundingBox.diagonalLength());
 			}
 		}
 	}
-	return count;
+
+	bool empty() const
+	{
+		return center.empty();
+	}
+};
+
+//sample a photon leaving a light towards the specular shapes, uniformly inside the cone
+//subtended by the bounding sphere of a randomly chosen one
+//return false if the sample carries no power
+bool emitCausticPhoton(Scene* scene, const CausticTargets& targets, Eigen::Vector3f& ori, Eigen::Vector3f& dir, Eigen::Vector3f& power)
+{
+	STATS_INC(STAT_PHOTONS_EMITTED);
+	float lightPickPDF, lightPosPDF;
+	Light* light = scene->sampleEmitter(lightPickPDF);
+	if (light == nullptr)
+		return false;
+	Eigen::Vector3f normal;
+	Eigen::Vector3f lightColor = light->SampleEmissionPos(ori, normal, lightPosPDF);
+	if (lightPosPDF == 0.0f)
+		return false;
+
+	int count = (int)targets.center.size();
+	int t = std::min((int)(randomFloat() * count), count - 1);
+	Eigen::Vector3f axis = targets.center[t] - ori;
+	float dist = axis.norm();
+	axis /= dist;
+	float cosMax = dist > targets.radius[t] ? sqrtf(1.0f - targets.radius[t] * targets.radius[t] / (dist * dist)) : -1.0f;
+	float cosTheta = 1.0f - randomFloat() * (1.0f - cosMax);
+	float sinTheta = sqrtf(std::fmax(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * M_PIf * randomFloat();
+	Eigen::Vector3f u = (std::fabs(axis.x()) > 0.1f ? Eigen::Vector3f(0, 1, 0) : Eigen::Vector3f(1, 0, 0)).cross(axis).normalized();
+	Eigen::Vector3f v = axis.cross(u);
+	dir = sinTheta * cosf(phi) * u + sinTheta * sinf(phi) * v + cosTheta * axis;
+
+	// the direction may lie in several cones, its PDF is the mixture of all of them
+	float lightDirPDF = 0.0f;
+	for (int j = 0; j < count; j++)
+	{
+		Eigen::Vector3f a = targets.center[j] - ori;
+		float d = a.norm();
+		float c = d > targets.radius[j] ? sqrtf(1.0f - targets.radius[j] * targets.radius[j] / (d * d)) : -1.0f;
+		if (dir.dot(a) >= c * d)
+			lightDirPDF += 1.0f / (2.0f * M_PIf * (1.0f - c) * count);
+	}
+	float cosLight = normal.dot(dir);
+	if (cosLight <= 0.0f || lightDirPDF == 0.0f)
+		return false;
+	power = lightColor * cosLight / (lightPickPDF * lightPosPDF * lightDirPDF);
+	return true;
 }
-//return number of photons
-int causticsPhotonTracing(Scene* scene, Map& photonMap, Eigen::Vector3f objPos, int n)
+
+//photon ray footprint for @emissions emissions: about the spacing of as many photons
+//spread over the surface of the scene bounds, the area one photon stands for
+inline float photonFootprint(const Scene& scene, int emissions)
+{
+	Eigen::Vector3f size = scene.getBoundingBox().ub - scene.getBoundingBox().lb;
+	float area = 2.0f * (size.x() * size.y() + size.y() * size.z() + size.z() * size.x());
+	return std::sqrt(area / std::max(emissions, 1));
+}
+
+//what one photon path did, kept to find out whether a change of the scene affects it
+struct PhotonPathRecord
+{
+	//a ray of the path, up to its hit or to the end of the ray if it left the scene
+	struct Segment
+	{
+		Eigen::Vector3f ori, dir;
+		float length;
+	};
+
+	//bits of Scene::crossedShapes for all rays of the path
+	uint64_t shapeMask = 0;
+	std::vector<Segment> segments;
+	//photons of the path, position, incident direction and unscaled power
+	std::vector<Photon> photons;
+
+	void clear()
+	{
+		shapeMask = 0;
+		segments.clear();
+		photons.clear();
+	}
+
+	void addSegment(const Ray& ray, bool hit, float dist)
+	{
+		segments.push_back({ ray.m_Ori, ray.m_Dir, hit ? dist : ray.m_fMax });
+	}
+
+	void store(const Eigen::Vector3f& pos, const Eigen::Vector3f& dir, const Eigen::Vector3f& power)
+	{
+		Photon p;
+		p.pos = pos;
+		p.dir = dir;
+		p.power = power;
+		photons.push_back(p);
+	}
+};
+
+//intersect a photon ray, recording it in @record if there is one
+inline bool photonIntersection(Scene* scene, Ray& ray, Interaction& interaction, PhotonPathRecord* record)
+{
+	STATS_INC(STAT_PHOTON_RAYS);
+	if (record == nullptr)
+		return scene->intersection(&ray, interaction);
+	bool hit = scene->intersection(&ray, interaction, &record->shapeMask);
+	record->addSegment(ray, hit, interaction.entryDist);
+	return hit;
+}
+
+//trace one global photon, return the number of photons it stored
+//a photon is stored at every diffuse hit but the first, direct light is sampled at render time
+//and light - specular - diffuse paths are caustics, their first diffuse hit is in the caustic map
+//with a @record the path is recorded there, its photons included, instead of stored in @photonMap
+int traceGlobalPhoton(Scene* scene, PhotonMap& photonMap, PhotonPathRecord* record = nullptr)
 {
-	Light* light = scene->lights[0];
 	int count = 0;
-	for (int i = 0; i < n; ++i)
+	bool firstDiffuseHit = true;
+	Eigen::Vector3f lightPos, lightDir, power;
+	if (!emitPhoton(scene, lightPos, lightDir, power))
+		return 0;
+	Ray currRay(lightPos, lightDir);
+	currRay.m_Width = scene->photonFootprint;
+	Interaction surfaceInteraction;
+	while (1)
 	{
-		float lightPosPDF;
-		Eigen::Vector3f lightPos, lightColor, lightDir;
-		while (1)
+		bool intersection = photonIntersection(scene, currRay, surfaceInteraction, record);
+		if (intersection == false)
+			break;
+		if (((BSDF*)surfaceInteraction.material)->isSpecular == true)
 		{
-			lightColor = light->SampleSurfacePos(lightPos, lightPosPDF);
-			Eigen::Vector3f relativePos = objPos - lightPos;
-			float rand1 = 2.0f * ((float)rand() / (float)RAND_MAX) - 1.0f;
-			lightDir.x() = relativePos.x() + rand1;
-			float rand2 = 2.0f * ((float)rand() / (float)RAND_MAX) - 1.0f;
-			lightDir.y() = relativePos.y() + rand2;
-			float rand3 = 2.0f * ((float)rand() / (float)RAND_MAX) - 1.0f;
-			lightDir.z() = relativePos.z() + rand3;
-			Ray currRay(lightPos, lightDir);
-			Interaction surfaceInteraction;
-			bool intersection = scene->intersection(&currRay, surfaceInteraction);
-			if (intersection == false)
-				continue;
-			if (((BSDF*)surfaceInteraction.material)->isSpecular == true)
+			if (!specularBounce(surfaceInteraction, currRay, power))
 				break;
 		}
-		Ray currRay(lightPos, lightDir);
-		Interaction surfaceInteraction;
-		while (1)
+		else
 		{
-			bool intersection = scene->intersection(&currRay, surfaceInteraction);
-			if (intersection == false)
-				break;
-			if (((BSDF*)surfaceInteraction.material)->isSpecular == true)
+			surfaceInteraction.inputDir = -currRay.m_Dir;
+			if (firstDiffuseHit)
+				firstDiffuseHit = false;
+			else 
 			{
-				surfaceInteraction.inputDir = -currRay.m_Dir;
-				//((BSDF*)surfaceInteraction.material)->sample(surfaceInteraction);
-				Eigen::Vector3f L = surfaceInteraction.inputDir.normalized();
-				Eigen::Vector3f N = surfaceInteraction.normal.normalized();
-				float LdotN = L.dot(N);
-				if (LdotN >= 0)
-				{
-					float n1 = 1.0f;
-					float n2 = 1.5f;
-					float cos1 = LdotN / (L.norm() * N.norm());
-					float sin1 = sqrtf(1 - cos1 * cos1);
-					float sin2 = n1 * sin1 / n2;
-					float angle1 = acosf(cos1);
-					float angle2 = asinf(sin2);
-					float reflectRatio = 0.5f * ((sinf(angle1 - angle2) * sinf(angle1 - angle2)) / (sinf(angle1 + angle2) * sinf(angle1 + angle2)) + (tanf(angle1 - angle2) * tanf(angle1 - angle2)) / (tanf(angle1 + angle2) * tanf(angle1 + angle2)));
-					float rand = (float)std::rand() / (float)RAND_MAX;
-					if (rand < reflectRatio) //reflect
-					{
-						Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-						surfaceInteraction.outputDir = outputDir.normalized();
-					}
-					else //refract
-					{
-						Eigen::Vector3f outputDir = (n1 * LdotN / n2 - sqrtf(1 - n1 * n1 * (1 - LdotN * LdotN) / (n2 * n2))) * N - n1 * L / n2;
-						surfaceInteraction.outputDir = outputDir.normalized();
-					}
-				}
+				if (record != nullptr)
+					record->store(surfaceInteraction.entryPoint, surfaceInteraction.inputDir, power);
 				else
-				{
-					float n1 = 1.5f;
-					float n2 = 1.0f;
-					float temp = 1 - n1 * n1 * (1 - LdotN * LdotN) / (n2 * n2);
-					if (temp < 0) //total internal reflection
-					{
-						Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-						surfaceInteraction.outputDir = outputDir.normalized();
-					}
-					else
-					{
-						LdotN = -LdotN;
-						N = -N;
-						float cos1 = LdotN / (L.norm() * N.norm());
-						float sin1 = sqrtf(1 - cos1 * cos1);
-						float sin2 = n1 * sin1 / n2;
-						float angle1 = acosf(cos1);
-						float angle2 = asinf(sin2);
-						float reflectRatio = 0.5f * ((sinf(angle1 - angle2) * sinf(angle1 - angle2)) / (sinf(angle1 + angle2) * sinf(angle1 + angle2)) + (tanf(angle1 - angle2) * tanf(angle1 - angle2)) / (tanf(angle1 + angle2) * tanf(angle1 + angle2)));
-						float rand = (float)std::rand() / (float)RAND_MAX;
-						if (rand < reflectRatio) //reflect
-						{
-							Eigen::Vector3f outputDir = -L + 2.0f * LdotN * N;
-							surfaceInteraction.outputDir = outputDir.normalized();
-						}
-						else //refract
-						{
-							Eigen::Vector3f outputDir = (n1 * LdotN / n2 - sqrtf(temp)) * N - n1 * L / n2;
-							surfaceInteraction.outputDir = outputDir.normalized();
-						}
-					}
-				}
-				currRay.m_Ori = surfaceInteraction.entryPoint;
-				currRay.m_Dir = surfaceInteraction.outputDir;
-			}
-			else
-			{
-				surfaceInteraction.inputDir = -currRay.m_Dir;
-				((BSDF*)surfaceInteraction.material)->sample(surfaceInteraction);
-				currRay.m_Ori = surfaceInteraction.entryPoint;
-				currRay.m_Dir = surfaceInteraction.outputDir;
-				photonMap.store(surfaceInteraction.entryPoint, surfaceInteraction.inputDir);
+					photonMap.store(surfaceInteraction.entryPoint, surfaceInteraction.inputDir, power);
 				++count;
-				break;
 			}
+			if (!diffuseRussianRoulette(surfaceInteraction.surfaceColor, power))
+				break;
+			((BSDF*)surfaceInteraction.material)->sample(surfaceInteraction);
+			currRay.m_Ori = surfaceInteraction.entryPoint;
+			currRay.m_Dir = surfaceInteraction.outputDir;
 		}
 	}
 	return count;
-}
\ No newline at end of file
+}
+
+//trace one caustic photon, return 1 if it was stored
+//only light - specular - diffuse paths are caustics
+//with a @record the path is recorded there, its photon included, instead of stored in @photonMap
+int traceCausticPhoton(Scene* scene, const CausticTargets& targets, PhotonMap& photonMap, PhotonPathRecord* record = nullptr)
+{
+	Eigen::Vector3f lightPos, lightDir, power;
+	if (!emitCausticPhoton(scene, targets, lightPos, lightDir, power))
+		return 0;
+	Ray currRay(lightPos, lightDir);
+	currRay.m_Width = scene->photonFootprint;
+	Interaction surfaceInteraction;
+	bool specularPath = false;
+	while (1)
+	{
+		bool intersection = photonIntersection(scene, currRay, surfaceInteraction, record);
+		if (intersection == false)
+			return 0;
+		if (((BSDF*)surfaceInteraction.material)->isSpecular == true)
+		{
+			specularPath = true;
+			if (!specularBounce(surfaceInteraction, currRay, power))
+				return 0;
+		}
+		else
+		{
+			if (!specularPath)
+				return 0;
+			if (record != nullptr)
+				record->store(surfaceInteraction.entryPoint, -currRay.m_Dir, power);
+			else
+				photonMap.store(surfaceInteraction.entryPoint, -currRay.m_Dir, power);
+			return 1;
+		}
+	}
+}
+
+//return number of photons
+//photon power is not divided by the number of emitted photons, call
+//scale_photon_power(1.0f / emitted_photons) on the map once tracing is done
+//tracing stops early once @timeBudget seconds have passed, only the photons
+//actually emitted count towards emitted_photons
+int globalPhotonTracing(Scene* scene, PhotonMap &photonMap, int n, double timeBudget = 0.0)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int count = 0;
+	int i = 0;
+	for (; i < n && !photonBudgetExpired(start, timeBudget, i); ++i)
+		count += traceGlobalPhoton(scene, photonMap);
+	photonMap.emitted_photons += i;
+	return count;
+}
+
+//return number of photons
+//photons are emitted uniformly inside the cones subtended by the bounding spheres of the
+//specular shapes, so every emission counts towards emitted_photons even if it misses
+//tracing stops early once @timeBudget seconds have passed
+int causticsPhotonTracing(Scene* scene, PhotonMap& photonMap, int n, double timeBudget = 0.0)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CausticTargets targets(scene);
+	if (targets.empty())
+		return 0;
+
+	int count = 0;
+	int emitted = 0;
+	while (count < n && emitted < 100 * n && !photonBudgetExpired(start, timeBudget, emitted))
+	{
+		++emitted;
+		count += traceCausticPhoton(scene, targets, photonMap);
+	}
+	photonMap.emitted_photons += emitted;
+	return count;
+}
+
+//trace the photons with emission indices [begin, end), photon i drawing its random numbers
+//from stream i of @seed, so however the index range is split into shards the union of the
+//shards stores the same photons
+//tracing stops early once @timeBudget seconds have passed, only the photons actually
+//emitted count towards emitted_photons
+int globalPhotonShard(Scene* scene, PhotonMap& photonMap, int begin, int end, uint64_t seed, double timeBudget = 0.0)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int count = 0;
+	int i = begin;
+	for (; i < end && !photonBudgetExpired(start, timeBudget, i - begin); ++i)
+	{
+		threadSampler().setSeed(seed, (uint64_t)i);
+		count += traceGlobalPhoton(scene, photonMap);
+	}
+	photonMap.emitted_photons += i - begin;
+	return count;
+}
+
+//same as globalPhotonShard for caustic photons, the range counts emissions, not stored photons
+int causticsPhotonShard(Scene* scene, PhotonMap& photonMap, int begin, int end, uint64_t seed, double timeBudget = 0.0)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CausticTargets targets(scene);
+	if (targets.empty())
+		return 0;
+	int count = 0;
+	int i = begin;
+	for (; i < end && !photonBudgetExpired(start, timeBudget, i - begin); ++i)
+	{
+		threadSampler().setSeed(seed, (uint64_t)i);
+		count += traceCausticPhoton(scene, targets, photonMap);
+	}
+	photonMap.emitted_photons += i - begin;
+	return count;
+}
@@ -22,6 +22,11 @@ public:
     Eigen::Vector3f getPoint(float t) const {
         return m_Ori + t * m_Dir;
     }
+
+    // width of the ray cone at distance 't', the footprint used to filter textures
+    float footprint(float t) const {
+        return m_Width + t * m_Spread;
+    }
 	
     // original point of the ray
     Eigen::Vector3f m_Ori;
@@ -31,4 +36,9 @@ public:
     // the maximum and minimum value in the ray
     float   m_fMin;
     float   m_fMax;
+
+    // ray cone: width at the origin and growth of the width per unit of distance, both 0
+    // for rays that read the finest texture level
+    float   m_Width = 0.0f;
+    float   m_Spread = 0.0f;
 };
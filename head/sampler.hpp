@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+// Small PCG32 random number generator.
+// Every thread owns one, so sampling never contends on the shared state behind std::rand.
+class Sampler
+{
+public:
+	Sampler(uint64_t seed = 0, uint64_t stream = 0)
+	{
+		setSeed(seed, stream);
+	}
+
+	void setSeed(uint64_t seed, uint64_t stream = 0)
+	{
+		state = 0u;
+		inc = (stream << 1u) | 1u;
+		nextUInt();
+		state += seed;
+		nextUInt();
+	}
+
+	uint32_t nextUInt()
+	{
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = (uint32_t)(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+	}
+
+	// uniform float in [0, 1)
+	float nextFloat()
+	{
+		return (nextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+// Sampler of the calling thread, each thread gets its own stream
+inline Sampler& threadSampler()
+{
+	static std::atomic<uint64_t> nextStream(0);
+	thread_local Sampler sampler(0x853c49e6748fea9bULL, nextStream++);
+	return sampler;
+}
+
+// uniform float in [0, 1) from the calling thread's sampler
+inline float randomFloat()
+{
+	return threadSampler().nextFloat();
+}
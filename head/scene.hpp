@@ -5,11 +5,24 @@
 #include "light.hpp"
 #include "shape.hpp"
 #include "material.hpp"
+#include "lightBVH.hpp"
+#include "aliasTable.hpp"
+#include "sampler.hpp"
+#include "stats.hpp"
+#include "textureCache.hpp"
 class Scene
 {
 public:
 	std::vector<Shape*> shapes;
 	std::vector<Light*> lights;
+	// hierarchy over the lights, rebuilt whenever a light is added
+	LightBVH lightBVH;
+	// alias table over the lights' power, rebuilt with the hierarchy
+	AliasTable emitters;
+	// tiles of the shapes' textures, may be null if no shape is textured
+	TextureCache* textures = nullptr;
+	// ray cone width of photon rays, wide enough that photons read coarse texture levels
+	float photonFootprint = 0.0f;
 	Scene()
 	{
 	}
@@ -17,6 +30,28 @@ public:
 	void addLight(Light* light)
 	{
 		lights.push_back(light);
+		lightBVH.build(lights);
+		std::vector<float> power;
+		for (Light* l : lights)
+			power.push_back(LightBVH::luminance(l->getPower()));
+		emitters.build(power);
+	}
+
+	// Pick a light by its importance to a shading point with normal @n
+	// @pdf is the probability of the pick, nullptr if no light can reach the point
+	Light* sampleLight(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float& pdf)
+	{
+		int light = lightBVH.sample(p, n, randomFloat(), pdf);
+		return light == -1 ? nullptr : lights[light];
+	}
+
+	// Pick a light proportionally to its power, for photon emission
+	// every photon then leaves with the same flux, whichever light it comes from
+	Light* sampleEmitter(float& pdf)
+	{
+		if (emitters.empty())
+			return nullptr;
+		return lights[emitters.sample(randomFloat(), pdf)];
 	}
 
 	void addShape(Shape* shape)
@@ -29,9 +64,21 @@ public:
 		return shapes.size();
 	}
 
-	bool intersection(Ray* ray, Interaction& interaction)
+	// bounding box enclosing every shape
+	AABB getBoundingBox() const
 	{
+		AABB bounds = shapes[0]->m_BoundingBox;
+		for (int i = 1; i < (int)shapes.size(); i++)
+			bounds = AABB(bounds, shapes[i]->m_BoundingBox);
+		return bounds;
+	}
+
+	// @shapesCrossed, if given, gets the bits of crossedShapes up to the hit or the end of the ray
+	bool intersection(Ray* ray, Interaction& interaction, uint64_t* shapesCrossed = nullptr)
+	{
+		STATS_ADD(STAT_AABB_TESTS, shapes.size());
 		Interaction surfaceInteraction;
+		Shape* hitShape = nullptr;
 		for (Shape* shape : shapes)
 		{
 			Interaction curInteraction;
@@ -44,27 +91,54 @@ public:
 					{
 						surfaceInteraction = curInteraction;
 						surfaceInteraction.material = shape->material;
+						hitShape = shape;
 					}
 				}
 			}
 		}
-		surfaceInteraction.lightId = -1;
-		for (int i = 0; i < lights.size(); i++) {
-			if (lights[i]->isHit(ray, &surfaceInteraction)) {
-				surfaceInteraction.lightId = i;
-			}
-		}
+		// a light behind the surface is not hit
+		bool surfaceHit = surfaceInteraction.entryDist != -1 && surfaceInteraction.entryDist >= ray->m_fMin;
+		surfaceInteraction.lightId = surfaceHit ? lightBVH.intersect(ray, surfaceInteraction.entryDist) : lightBVH.intersect(ray);
 		interaction = surfaceInteraction;
 		if (surfaceInteraction.entryDist != -1 && surfaceInteraction.entryDist >= ray->m_fMin && surfaceInteraction.entryDist <= ray->m_fMax)
 		{
-
+			interaction.frame = Frame(interaction.normal);
+			if (hitShape != nullptr && hitShape->texture >= 0 && interaction.hasTexCoord && textures != nullptr)
+				applyTexture(*ray, hitShape->texture, interaction);
+			if (shapesCrossed != nullptr)
+				*shapesCrossed |= crossedShapes(*ray, interaction.entryDist);
 			return true;
 		}
+		if (shapesCrossed != nullptr)
+			*shapesCrossed |= crossedShapes(*ray, ray->m_fMax);
 		return false;
 	}
 
+	// bit (index % 64) of every shape whose bounds @ray enters before distance @dist
+	uint64_t crossedShapes(const Ray& ray, float dist)
+	{
+		uint64_t mask = 0;
+		for (int i = 0; i < (int)shapes.size(); i++)
+		{
+			float tMin, tMax;
+			if (shapes[i]->m_BoundingBox.rayIntersection(ray, tMin, tMax) && tMin <= dist)
+				mask |= uint64_t(1) << (i % 64);
+		}
+		return mask;
+	}
+
+	// modulate the color of the hit by the texture, filtered over the ray cone's footprint
+	// stretched by the angle of incidence
+	void applyTexture(const Ray& ray, int texture, Interaction& interaction)
+	{
+		float cosine = std::max(std::fabs(interaction.frame.n.dot(ray.m_Dir)), 0.05f);
+		float width = ray.footprint(interaction.entryDist) / cosine * interaction.uvPerUnit;
+		interaction.surfaceColor = interaction.surfaceColor.cwiseProduct(textures->lookup(texture, interaction.texCoord, width));
+	}
+
 	bool intersection(Ray* ray)
 	{
+		STATS_ADD(STAT_AABB_TESTS, shapes.size());
 		Interaction surfaceInteraction;
 		for (Shape* shape : shapes)
 		{
@@ -85,6 +159,7 @@ public:
 		{
 			return true;
 		}
-		return false;
+		// lights block the ray as well, one light may stand in front of another
+		return lightBVH.intersect(ray) != -1;
 	}
 };
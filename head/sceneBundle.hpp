@@ -0,0 +1,354 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "Eigen/Dense"
+#include "mappedFile.hpp"
+#include "camera.hpp"
+#include "material.hpp"
+#include "light.hpp"
+#include "shape.hpp"
+#include "parallelogram.hpp"
+#include "triangleMesh.hpp"
+#include "scene.hpp"
+
+// 64-bit FNV-1a hash of a block of memory, chain calls through @hash
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// hash of the contents of a file, 0 if it cannot be read
+inline uint64_t hashFile(const std::string& path, uint64_t hash = 14695981039346656037ULL)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return 0;
+	return hashBytes(file.data(), file.size(), hash);
+}
+
+// A built scene as one binary file.
+// Holds the camera, materials, lights and shapes, meshes with their transformed vertex and
+// index buffers and their uniform grid, so a re-render maps the file and copies whole
+// arrays instead of parsing OBJ text and rebuilding the grid. The header keeps a hash of
+// whatever the scene was built from; a bundle built from other sources is rejected.
+// Shapes keep their texture ids, the textures themselves are opened into the scene's
+// TextureCache in the same order on every run.
+class SceneBundle
+{
+public:
+	enum : uint32_t { version = 3 };
+
+	std::unique_ptr<Camera> camera;
+	std::vector<std::unique_ptr<BSDF>> materials;
+	std::vector<std::unique_ptr<Shape>> shapes;
+	std::vector<std::unique_ptr<Light>> lights;
+
+	// take ownership of an object of the scene
+	template <class T> T* addMaterial(T* material) { materials.emplace_back(material); return material; }
+	template <class T> T* addShape(T* shape) { shapes.emplace_back(shape); return shape; }
+	template <class T> T* addLight(T* light) { lights.emplace_back(light); return light; }
+
+	void clear()
+	{
+		camera.reset();
+		shapes.clear();
+		lights.clear();
+		materials.clear();
+	}
+
+	// add the shapes and lights to @scene, which must not outlive the bundle
+	void addTo(Scene& scene) const
+	{
+		for (const std::unique_ptr<Shape>& shape : shapes)
+			scene.addShape(shape.get());
+		for (const std::unique_ptr<Light>& light : lights)
+			scene.addLight(light.get());
+	}
+
+	bool save(const std::string& path, uint64_t sourceHash) const
+	{
+		std::vector<char> out;
+		Writer w{ out };
+		w.put(magic);
+		w.put(version);
+		w.put(sourceHash);
+
+		w.put(camera->m_Pos);
+		w.put(camera->m_Forward);
+		w.put(camera->m_Right);
+		w.put(camera->m_Up);
+		w.put(camera->m_Film.m_Res);
+
+		w.put((uint32_t)materials.size());
+		for (const std::unique_ptr<BSDF>& material : materials)
+		{
+			if (Dielectric* dielectric = dynamic_cast<Dielectric*>(material.get()))
+			{
+				w.put(MATERIAL_DIELECTRIC);
+				w.put(dielectric->ior);
+			}
+			else if (dynamic_cast<IdealSpecular*>(material.get()) != nullptr)
+				w.put(MATERIAL_SPECULAR);
+			else if (dynamic_cast<IdealDiffuse*>(material.get()) != nullptr)
+				w.put(MATERIAL_DIFFUSE);
+			else
+				return false;
+		}
+
+		w.put((uint32_t)lights.size());
+		for (const std::unique_ptr<Light>& light : lights)
+		{
+			if (dynamic_cast<AreaLight*>(light.get()) != nullptr)
+			{
+				w.put(LIGHT_AREA);
+				w.put(light->m_Pos);
+			}
+			else if (QuadLight* quad = dynamic_cast<QuadLight*>(light.get()))
+			{
+				w.put(LIGHT_QUAD);
+				w.put(quad->corner);
+				w.put(quad->edge0);
+				w.put(quad->edge1);
+			}
+			else if (SphereLight* sphere = dynamic_cast<SphereLight*>(light.get()))
+			{
+				w.put(LIGHT_SPHERE);
+				w.put(sphere->m_Pos);
+				w.put(sphere->radius);
+			}
+			else if (MeshLight* mesh = dynamic_cast<MeshLight*>(light.get()))
+			{
+				w.put(LIGHT_MESH);
+				w.putArray(mesh->vertices);
+			}
+			else
+				return false;
+			w.put(light->m_Color);
+		}
+
+		w.put((uint32_t)shapes.size());
+		for (const std::unique_ptr<Shape>& shape : shapes)
+		{
+			int32_t material = -1;
+			for (size_t m = 0; m < materials.size(); m++)
+				if (materials[m].get() == shape->material)
+					material = (int32_t)m;
+			if (Parallelogram* p = dynamic_cast<Parallelogram*>(shape.get()))
+			{
+				w.put(SHAPE_PARALLELOGRAM);
+				w.put(material);
+				w.put(p->color);
+				w.put((int32_t)p->texture);
+				w.put(p->p0);
+				w.put(Eigen::Vector3f(p->s0 * p->s0_len));
+				w.put(Eigen::Vector3f(p->s1 * p->s1_len));
+				w.put(p->normal);
+			}
+			else if (TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(shape.get()))
+			{
+				w.put(SHAPE_MESH);
+				w.put(material);
+				w.put(mesh->color);
+				w.put((int32_t)mesh->texture);
+				w.put(mesh->m_BoundingBox.lb);
+				w.put(mesh->m_BoundingBox.ub);
+				w.put((int32_t)mesh->triangleCount);
+				w.put((int32_t)mesh->vertexCount);
+				w.putArray(mesh->positions);
+				w.putArray(mesh->quantizedPositions);
+				w.put(mesh->positionScale);
+				w.putArray(mesh->quantizedUVs);
+				w.put(mesh->uvMin);
+				w.put(mesh->uvScale);
+				w.putArray(mesh->normals);
+				w.putArray(mesh->indices16);
+				w.putArray(mesh->indices32);
+				w.put((int32_t)mesh->isUniformExisting);
+				w.put(mesh->gridDim);
+				w.put(mesh->gridDeltaDist);
+				w.putArray(mesh->gridOffsets);
+				w.putArray(mesh->gridTriangles);
+			}
+			else
+				return false;
+		}
+
+		FILE* file = std::fopen(path.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+		bool ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+		return std::fclose(file) == 0 && ok;
+	}
+
+	// replace the contents by the bundle at @path
+	// return false if it is missing, damaged, of another version or built from other sources
+	bool load(const std::string& path, uint64_t sourceHash)
+	{
+		MappedFile file;
+		if (!file.open(path))
+			return false;
+		Reader r{ file.data(), file.data() + file.size() };
+		uint32_t fileMagic = 0, fileVersion = 0;
+		uint64_t fileHash = 0;
+		if (!r.get(fileMagic) || fileMagic != magic || !r.get(fileVersion) || fileVersion != version
+			|| !r.get(fileHash) || fileHash != sourceHash)
+			return false;
+
+		clear();
+
+		Eigen::Vector3f pos, forward, right, up;
+		Eigen::Vector2i res;
+		if (!r.get(pos) || !r.get(forward) || !r.get(right) || !r.get(up) || !r.get(res) || res.minCoeff() <= 0)
+			return false;
+		camera.reset(new Camera(pos, pos + forward, up.normalized(), 45.0f, res));
+		camera->m_Forward = forward;
+		camera->m_Right = right;
+		camera->m_Up = up;
+
+		uint32_t count = 0;
+		if (!r.get(count))
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t type = 0;
+			float ior = 1.0f;
+			if (!r.get(type))
+				return false;
+			if (type == MATERIAL_DIELECTRIC && r.get(ior))
+				materials.emplace_back(new Dielectric(ior));
+			else if (type == MATERIAL_SPECULAR)
+				materials.emplace_back(new IdealSpecular());
+			else if (type == MATERIAL_DIFFUSE)
+				materials.emplace_back(new IdealDiffuse());
+			else
+				return false;
+		}
+
+		if (!r.get(count))
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t type = 0;
+			Eigen::Vector3f lightPos, edge0, edge1, color;
+			float radius = 0.0f;
+			std::vector<Eigen::Vector3f> vertices;
+			if (!r.get(type))
+				return false;
+			if (type == LIGHT_AREA && r.get(lightPos) && r.get(color))
+				lights.emplace_back(new AreaLight(lightPos, color));
+			else if (type == LIGHT_QUAD && r.get(lightPos) && r.get(edge0) && r.get(edge1) && r.get(color))
+				lights.emplace_back(new QuadLight(lightPos, edge0, edge1, color));
+			else if (type == LIGHT_SPHERE && r.get(lightPos) && r.get(radius) && r.get(color))
+				lights.emplace_back(new SphereLight(lightPos, radius, color));
+			else if (type == LIGHT_MESH && r.getArray(vertices) && r.get(color))
+				lights.emplace_back(new MeshLight(std::move(vertices), color));
+			else
+				return false;
+		}
+
+		if (!r.get(count))
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t type = 0;
+			int32_t material = -1, texture = -1;
+			Eigen::Vector3f color;
+			if (!r.get(type) || !r.get(material) || material >= (int32_t)materials.size() || !r.get(color) || !r.get(texture))
+				return false;
+			if (type == SHAPE_PARALLELOGRAM)
+			{
+				Eigen::Vector3f p0, s0, s1, normal;
+				if (!r.get(p0) || !r.get(s0) || !r.get(s1) || !r.get(normal))
+					return false;
+				shapes.emplace_back(new Parallelogram(p0, s0, s1, normal, color));
+			}
+			else if (type == SHAPE_MESH)
+			{
+				TriangleMesh* mesh = new TriangleMesh(color);
+				shapes.emplace_back(mesh);
+				int32_t triangleCount = 0, vertexCount = 0, isUniform = 0;
+				if (!r.get(mesh->m_BoundingBox.lb) || !r.get(mesh->m_BoundingBox.ub) || !r.get(triangleCount)
+					|| !r.get(vertexCount) || !r.getArray(mesh->positions) || !r.getArray(mesh->quantizedPositions)
+					|| !r.get(mesh->positionScale) || !r.getArray(mesh->quantizedUVs) || !r.get(mesh->uvMin)
+					|| !r.get(mesh->uvScale) || !r.getArray(mesh->normals)
+					|| !r.getArray(mesh->indices16) || !r.getArray(mesh->indices32)
+					|| !r.get(isUniform) || !r.get(mesh->gridDim) || !r.get(mesh->gridDeltaDist)
+					|| !r.getArray(mesh->gridOffsets) || !r.getArray(mesh->gridTriangles))
+					return false;
+				mesh->triangleCount = triangleCount;
+				mesh->vertexCount = vertexCount;
+				mesh->isUniformExisting = isUniform != 0;
+			}
+			else
+				return false;
+			shapes.back()->material = material >= 0 ? materials[material].get() : nullptr;
+			shapes.back()->texture = texture;
+		}
+		return true;
+	}
+
+private:
+	enum : uint32_t { magic = 0x4253504d };	// "MPSB"
+	enum : uint32_t { MATERIAL_DIFFUSE, MATERIAL_SPECULAR, MATERIAL_DIELECTRIC };
+	enum : uint32_t { LIGHT_AREA, LIGHT_QUAD, LIGHT_SPHERE, LIGHT_MESH };
+	enum : uint32_t { SHAPE_PARALLELOGRAM, SHAPE_MESH };
+
+	// appends plain values, arrays are a count followed by the elements, padded to 8 bytes
+	struct Writer
+	{
+		std::vector<char>& out;
+
+		template <class T> void put(const T& value)
+		{
+			out.insert(out.end(), (const char*)&value, (const char*)&value + sizeof(T));
+		}
+
+		template <class T> void putArray(const std::vector<T>& values)
+		{
+			size_t bytes = values.size() * sizeof(T);
+			put((uint64_t)values.size());
+			out.insert(out.end(), (const char*)values.data(), (const char*)values.data() + bytes);
+			out.resize(out.size() + (((bytes + 7) & ~(size_t)7) - bytes), 0);
+		}
+	};
+
+	// reads what Writer wrote, failing instead of reading past the end
+	struct Reader
+	{
+		const char* p;
+		const char* end;
+
+		template <class T> bool get(T& value)
+		{
+			if ((size_t)(end - p) < sizeof(T))
+				return false;
+			std::memcpy((void*)&value, p, sizeof(T));
+			p += sizeof(T);
+			return true;
+		}
+
+		// one bulk copy of the whole array out of the mapping
+		template <class T> bool getArray(std::vector<T>& values)
+		{
+			uint64_t count = 0;
+			if (!get(count) || count > (uint64_t)(end - p) / sizeof(T))
+				return false;
+			values.resize((size_t)count);
+			std::memcpy((void*)values.data(), p, (size_t)count * sizeof(T));
+			p += (((size_t)count * sizeof(T)) + 7) & ~(size_t)7;
+			if (p > end)
+				p = end;
+			return true;
+		}
+	};
+};
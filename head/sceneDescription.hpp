@@ -0,0 +1,150 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <ostream>
+#include "Eigen/Dense"
+#include "camera.hpp"
+#include "material.hpp"
+#include "light.hpp"
+#include "parallelogram.hpp"
+#include "triangleMesh.hpp"
+#include "sceneBundle.hpp"
+
+// Everything a built scene depends on, as plain values: the camera, the walls, the meshes
+// with their files and transforms, the lights and the materials. The scene is built from
+// the description alone, so its hash keys a SceneBundle: any change of an input, or of the
+// contents of a mesh file, gives another hash and the bundle is built again.
+struct SceneDescription
+{
+	enum Material : int32_t { DIFFUSE, SPECULAR, GLASS };
+
+	struct Quad
+	{
+		Eigen::Vector3f p0, s0, s1, normal, color;
+		Material material;
+		// texture id in the scene's TextureCache, -1 for none
+		int texture;
+	};
+
+	struct Mesh
+	{
+		std::string path;
+		Eigen::Vector3f color;
+		Eigen::Affine3f transform;
+		Material material;
+		// store positions as 16-bit offsets in the mesh bounds instead of floats
+		bool quantize;
+	};
+
+	struct AreaLightSpec
+	{
+		Eigen::Vector3f pos, color;
+	};
+
+	Eigen::Vector3f cameraPosition, cameraLookAt, cameraUp;
+	float verticalFov;
+	Eigen::Vector2i filmRes;
+	// index of refraction of GLASS
+	float ior = 1.5f;
+	std::vector<Quad> quads;
+	std::vector<Mesh> meshes;
+	std::vector<AreaLightSpec> lights;
+
+	// hash of every value above and of the contents of the mesh files, 0 if one cannot be read
+	uint64_t hash() const
+	{
+		uint64_t h = hashBytes(nullptr, 0);
+		auto put = [&h](const void* data, size_t size) { h = hashBytes(data, size, h); };
+		auto putVector = [&put](const Eigen::Vector3f& v) { put(v.data(), 3 * sizeof(float)); };
+		putVector(cameraPosition);
+		putVector(cameraLookAt);
+		putVector(cameraUp);
+		put(&verticalFov, sizeof(verticalFov));
+		put(filmRes.data(), 2 * sizeof(int));
+		put(&ior, sizeof(ior));
+		for (const Quad& quad : quads)
+		{
+			putVector(quad.p0);
+			putVector(quad.s0);
+			putVector(quad.s1);
+			putVector(quad.normal);
+			putVector(quad.color);
+			put(&quad.material, sizeof(quad.material));
+			put(&quad.texture, sizeof(quad.texture));
+		}
+		for (const Mesh& mesh : meshes)
+		{
+			put(mesh.path.data(), mesh.path.size());
+			h = hashFile(mesh.path, h);
+			if (h == 0)
+				return 0;
+			putVector(mesh.color);
+			put(mesh.transform.matrix().data(), 16 * sizeof(float));
+			put(&mesh.material, sizeof(mesh.material));
+			put(&mesh.quantize, sizeof(mesh.quantize));
+		}
+		for (const AreaLightSpec& light : lights)
+		{
+			putVector(light.pos);
+			putVector(light.color);
+		}
+		// lists of different lengths must not run into each other
+		uint32_t counts[3] = { (uint32_t)quads.size(), (uint32_t)meshes.size(), (uint32_t)lights.size() };
+		put(counts, sizeof(counts));
+		return h;
+	}
+
+	// replace the contents of @bundle by the built scene, @log, if given, receives the mesh grid statistics
+	void build(SceneBundle& bundle, std::ostream* log = nullptr) const
+	{
+		bundle.clear();
+		bundle.camera.reset(new Camera(cameraPosition, cameraLookAt, cameraUp, verticalFov, filmRes));
+		BSDF* materials[3] = { bundle.addMaterial(new IdealDiffuse()), bundle.addMaterial(new IdealSpecular()), bundle.addMaterial(new Dielectric(ior)) };
+		for (const Quad& quad : quads)
+		{
+			Parallelogram* p = bundle.addShape(new Parallelogram(quad.p0, quad.s0, quad.s1, quad.normal, quad.color));
+			p->material = materials[quad.material];
+			p->texture = quad.texture;
+		}
+		for (const Mesh& spec : meshes)
+		{
+			TriangleMesh* mesh = bundle.addShape(new TriangleMesh(spec.color, spec.path));
+			mesh->applyTransformation(spec.transform);
+			if (spec.quantize)
+				mesh->quantizePositions();
+			mesh->buildUniformGrid(log);
+			mesh->material = materials[spec.material];
+		}
+		for (const AreaLightSpec& light : lights)
+			bundle.addLight(new AreaLight(light.pos, light.color));
+	}
+};
+
+// The Cornell box: five walls, the back one textured with @backWallTexture, a glass mesh
+// read from @meshPath and an area light under the ceiling
+SceneDescription cornellBox(const std::string& meshPath, int backWallTexture = -1)
+{
+	SceneDescription scene;
+	scene.cameraPosition = Eigen::Vector3f(0, 0, 10);
+	scene.cameraLookAt = Eigen::Vector3f(0, 0, 0);
+	scene.cameraUp = Eigen::Vector3f(0, 1, 0);
+	scene.verticalFov = 45;
+	scene.filmRes = Eigen::Vector2i(500, 500);
+
+	Eigen::Vector3f grey(0.7f, 0.7f, 0.7f);
+	scene.quads.push_back({ Eigen::Vector3f(-10, -10, -10), Eigen::Vector3f(20, 0, 0), Eigen::Vector3f(0, 20, 0), Eigen::Vector3f(0, 0, 1), grey, SceneDescription::DIFFUSE, backWallTexture });
+	scene.quads.push_back({ Eigen::Vector3f(-6, -7, -11), Eigen::Vector3f(0, 0, 20), Eigen::Vector3f(0, 20, 0), Eigen::Vector3f(1, 0, 0), Eigen::Vector3f(1, 0, 0), SceneDescription::DIFFUSE, -1 });
+	scene.quads.push_back({ Eigen::Vector3f(6, -7, -11), Eigen::Vector3f(0, 0, 20), Eigen::Vector3f(0, 20, 0), Eigen::Vector3f(-1, 0, 0), Eigen::Vector3f(0, 1, 0), SceneDescription::DIFFUSE, -1 });
+	scene.quads.push_back({ Eigen::Vector3f(-7, -6, -11), Eigen::Vector3f(20, 0, 0), Eigen::Vector3f(0, 0, 20), Eigen::Vector3f(0, 1, 0), grey, SceneDescription::DIFFUSE, -1 });
+	scene.quads.push_back({ Eigen::Vector3f(-7, 6, -11), Eigen::Vector3f(20, 0, 0), Eigen::Vector3f(0, 0, 20), Eigen::Vector3f(0, -1, 0), grey, SceneDescription::DIFFUSE, -1 });
+
+	Eigen::Affine3f transform;
+	transform = Eigen::Translation3f(3, -2, -8) * Eigen::Scaling(0.5f);
+	scene.meshes.push_back({ meshPath, Eigen::Vector3f(1, 1, 1), transform, SceneDescription::GLASS, true });
+
+	// bright enough for the walls to come out about mid grey, the film has no exposure
+	scene.lights.push_back({ Eigen::Vector3f(0.0f, 5.8f, -5.0f), Eigen::Vector3f(40.0f, 40.0f, 40.0f) });
+	return scene;
+}
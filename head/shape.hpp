@@ -16,4 +16,6 @@ public:
 	AABB m_BoundingBox;
 	Eigen::Vector3f color;
 	BSDF* material = nullptr;
+	// texture in Scene::textures modulating the color, -1 for none
+	int texture = -1;
 };
@@ -0,0 +1,220 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+// Render statistics: counters on the hot paths and the wall time of every stage, written
+// as JSON at the end of a run. Counters are per thread, so counting is a plain add to
+// thread-local memory; a thread's counts are folded into the totals when it exits.
+// Define NO_RENDER_STATS to compile every counter and timer out.
+
+enum StatCounter
+{
+	STAT_CAMERA_RAYS,
+	STAT_SHADOW_RAYS,
+	STAT_SPECULAR_RAYS,
+	STAT_PHOTON_RAYS,
+	STAT_AABB_TESTS,
+	STAT_GRID_CELLS,
+	STAT_TRIANGLE_TESTS,
+	STAT_KNN_NODES,
+	STAT_PHOTONS_GATHERED,
+	STAT_PHOTONS_EMITTED,
+	STAT_PHOTONS_STORED,
+	STAT_PHOTONS_DROPPED,
+	STAT_TEXTURE_LOOKUPS,
+	STAT_TEXTURE_TILE_MISSES,
+	STAT_COUNTER_COUNT
+};
+
+enum StatStage
+{
+	STAGE_TRACING,
+	STAGE_BALANCING,
+	STAGE_RENDERING,
+	STAGE_OUTPUT,
+	STAGE_COUNT
+};
+
+inline const char* statCounterName(int counter)
+{
+	static const char* names[STAT_COUNTER_COUNT] = {
+		"cameraRays", "shadowRays", "specularRays", "photonRays", "aabbTests", "gridCells", "triangleTests",
+		"knnNodes", "photonsGathered", "photonsEmitted", "photonsStored", "photonsDropped",
+		"textureLookups", "textureTileMisses"
+	};
+	return names[counter];
+}
+
+inline const char* statStageName(int stage)
+{
+	static const char* names[STAGE_COUNT] = { "tracing", "balancing", "rendering", "output" };
+	return names[stage];
+}
+
+#ifndef NO_RENDER_STATS
+
+class RenderStats
+{
+public:
+	static RenderStats& get()
+	{
+		static RenderStats stats;
+		return stats;
+	}
+
+	// counters of the calling thread, the pointer is constant-initialized so the hot path
+	// skips the guard of the registering thread_local
+	static uint64_t* local()
+	{
+		thread_local uint64_t* counts = nullptr;
+		if (counts == nullptr)
+			counts = registerThread();
+		return counts;
+	}
+
+	// totals of the exited threads plus the counts of the running ones, call once they are idle
+	std::vector<uint64_t> counters()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<uint64_t> sum(totals, totals + STAT_COUNTER_COUNT);
+		for (ThreadCounters* t : threads)
+			for (int c = 0; c < STAT_COUNTER_COUNT; c++)
+				sum[c] += t->counts[c];
+		return sum;
+	}
+
+	void addStageTime(int stage, double seconds)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stageSeconds[stage] += seconds;
+	}
+
+	double stageTime(int stage)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stageSeconds[stage];
+	}
+
+private:
+	static uint64_t* registerThread()
+	{
+		thread_local ThreadCounters counters;
+		return counters.counts;
+	}
+
+	struct ThreadCounters
+	{
+		uint64_t counts[STAT_COUNTER_COUNT] = {};
+
+		ThreadCounters()
+		{
+			RenderStats& stats = get();
+			std::lock_guard<std::mutex> lock(stats.mutex);
+			stats.threads.push_back(this);
+		}
+
+		~ThreadCounters()
+		{
+			RenderStats& stats = get();
+			std::lock_guard<std::mutex> lock(stats.mutex);
+			for (int c = 0; c < STAT_COUNTER_COUNT; c++)
+				stats.totals[c] += counts[c];
+			for (size_t i = 0; i < stats.threads.size(); i++)
+			{
+				if (stats.threads[i] == this)
+				{
+					stats.threads[i] = stats.threads.back();
+					stats.threads.pop_back();
+					break;
+				}
+			}
+		}
+	};
+
+	std::mutex mutex;
+	std::vector<ThreadCounters*> threads;
+	uint64_t totals[STAT_COUNTER_COUNT] = {};
+	double stageSeconds[STAGE_COUNT] = {};
+};
+
+#define STATS_ADD(counter, n) (RenderStats::local()[counter] += (uint64_t)(n))
+#define STATS_INC(counter) (++RenderStats::local()[counter])
+
+// adds the time from construction to stop() or destruction to a stage
+class StageTimer
+{
+public:
+	explicit StageTimer(int stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+
+	~StageTimer()
+	{
+		stop();
+	}
+
+	void stop()
+	{
+		if (stage < 0)
+			return;
+		RenderStats::get().addStageTime(stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		stage = -1;
+	}
+
+private:
+	int stage;
+	std::chrono::steady_clock::time_point start;
+};
+
+// current count of @counter on the calling thread
+inline uint64_t threadStat(StatCounter counter)
+{
+	return RenderStats::local()[counter];
+}
+
+// write the counters and stage times to @path
+inline bool writeStats(const std::string& path)
+{
+	FILE* file = std::fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	std::vector<uint64_t> counts = RenderStats::get().counters();
+	std::fprintf(file, "{\n  \"enabled\": true,\n  \"counters\": {\n");
+	for (int c = 0; c < STAT_COUNTER_COUNT; c++)
+		std::fprintf(file, "    \"%s\": %llu%s\n", statCounterName(c), (unsigned long long)counts[c], c + 1 < STAT_COUNTER_COUNT ? "," : "");
+	std::fprintf(file, "  },\n  \"stageSeconds\": {\n");
+	for (int s = 0; s < STAGE_COUNT; s++)
+		std::fprintf(file, "    \"%s\": %.6f%s\n", statStageName(s), RenderStats::get().stageTime(s), s + 1 < STAGE_COUNT ? "," : "");
+	std::fprintf(file, "  }\n}\n");
+	return std::fclose(file) == 0;
+}
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_INC(counter) ((void)0)
+
+class StageTimer
+{
+public:
+	explicit StageTimer(int) {}
+	void stop() {}
+};
+
+inline uint64_t threadStat(StatCounter)
+{
+	return 0;
+}
+
+inline bool writeStats(const std::string& path)
+{
+	FILE* file = std::fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	std::fprintf(file, "{\n  \"enabled\": false\n}\n");
+	return std::fclose(file) == 0;
+}
+
+#endif
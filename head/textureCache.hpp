@@ -0,0 +1,352 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include "Eigen/Dense"
+#include "stats.hpp"
+
+// Textures as tiled, mip-mapped files read through a cache of fixed size.
+// convertTexture turns a PPM or PFM into a tiled file: every mip level is cut into square
+// tiles of 8-bit sRGB texels, stored level by level in row order. Each tile carries one
+// extra row and column copied from its neighbours (wrapping at the edges), so a bilinear
+// lookup never needs a second tile. TextureCache pages tiles in on demand and evicts the
+// least recently used ones; its memory is allocated once and never grows, however much
+// texture data the files hold. Level 0 row 0 is the bottom of the image, at v = 0.
+
+namespace textureFile
+{
+	enum : uint32_t { magic = 0x5854504d };	// "MPTX"
+	enum : uint32_t { version = 1 };
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		int32_t width, height;
+		int32_t tileSize;
+		int32_t levelCount;
+	};
+
+	inline int levelWidth(const Header& h, int level) { return std::max(1, h.width >> level); }
+	inline int levelHeight(const Header& h, int level) { return std::max(1, h.height >> level); }
+	inline int tilesX(const Header& h, int level) { return (levelWidth(h, level) + h.tileSize - 1) / h.tileSize; }
+	inline int tilesY(const Header& h, int level) { return (levelHeight(h, level) + h.tileSize - 1) / h.tileSize; }
+	inline size_t tileBytes(const Header& h) { return size_t(h.tileSize + 1) * (h.tileSize + 1) * 3; }
+}
+
+// 8-bit sRGB to linear, exact for every code
+inline const float* srgbToLinearTable()
+{
+	static const std::vector<float> table = []() {
+		std::vector<float> t(256);
+		for (int i = 0; i < 256; i++)
+		{
+			float x = i / 255.0f;
+			t[i] = x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f);
+		}
+		return t;
+	}();
+	return table.data();
+}
+
+inline unsigned char linearToSRGB8(float x)
+{
+	x = std::min(std::max(x, 0.0f), 1.0f);
+	float y = x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f;
+	return (unsigned char)(y * 255.0f + 0.5f);
+}
+
+// read a binary PPM (P6, 8 bit) or a three channel PFM into linear @pixels, bottom row first
+inline bool readTextureSource(const std::string& path, int& width, int& height, std::vector<Eigen::Vector3f>& pixels)
+{
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+	char type[3] = {};
+	float scale = 0.0f;
+	int maxValue = 0;
+	bool ok = std::fscanf(file, "%2s %d %d", type, &width, &height) == 3 && width > 0 && height > 0;
+	bool pfm = ok && std::string(type) == "PF";
+	if (pfm)
+		ok = std::fscanf(file, "%f", &scale) == 1 && scale < 0.0f;	// little endian only
+	else
+		ok = ok && std::string(type) == "P6" && std::fscanf(file, "%d", &maxValue) == 1 && maxValue == 255;
+	ok = ok && std::fgetc(file) != EOF;	// the single whitespace ending the header
+	if (ok)
+		pixels.resize((size_t)width * height);
+	if (ok && pfm)
+		ok = std::fread(pixels.data(), sizeof(float) * 3, pixels.size(), file) == pixels.size();
+	else if (ok)
+	{
+		const float* toLinear = srgbToLinearTable();
+		std::vector<unsigned char> row((size_t)width * 3);
+		for (int y = height - 1; ok && y >= 0; y--)	// PPM rows are top first
+		{
+			ok = std::fread(row.data(), 1, row.size(), file) == row.size();
+			for (int x = 0; ok && x < width; x++)
+				pixels[(size_t)y * width + x] = Eigen::Vector3f(toLinear[row[3 * x]], toLinear[row[3 * x + 1]], toLinear[row[3 * x + 2]]);
+		}
+	}
+	std::fclose(file);
+	return ok;
+}
+
+// convert the PPM or PFM at @source into a tiled, mip-mapped texture at @path
+// levels are box filtered in linear space down to 1x1
+inline bool convertTexture(const std::string& source, const std::string& path, int tileSize = 32)
+{
+	textureFile::Header header = { textureFile::magic, textureFile::version, 0, 0, tileSize, 1 };
+	std::vector<Eigen::Vector3f> level;
+	if (tileSize < 1 || !readTextureSource(source, header.width, header.height, level))
+		return false;
+	while (textureFile::levelWidth(header, header.levelCount - 1) > 1 || textureFile::levelHeight(header, header.levelCount - 1) > 1)
+		header.levelCount++;
+
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	std::vector<unsigned char> tile(textureFile::tileBytes(header));
+	for (int l = 0; ok && l < header.levelCount; l++)
+	{
+		int w = textureFile::levelWidth(header, l), h = textureFile::levelHeight(header, l);
+		if (l > 0)
+		{
+			int pw = textureFile::levelWidth(header, l - 1), ph = textureFile::levelHeight(header, l - 1);
+			std::vector<Eigen::Vector3f> next((size_t)w * h);
+			for (int y = 0; y < h; y++)
+			{
+				int y0 = std::min(2 * y, ph - 1), y1 = std::min(2 * y + 1, ph - 1);
+				for (int x = 0; x < w; x++)
+				{
+					int x0 = std::min(2 * x, pw - 1), x1 = std::min(2 * x + 1, pw - 1);
+					next[(size_t)y * w + x] = 0.25f * (level[(size_t)y0 * pw + x0] + level[(size_t)y0 * pw + x1]
+						+ level[(size_t)y1 * pw + x0] + level[(size_t)y1 * pw + x1]);
+				}
+			}
+			level.swap(next);
+		}
+		for (int ty = 0; ok && ty < textureFile::tilesY(header, l); ty++)
+		{
+			for (int tx = 0; ok && tx < textureFile::tilesX(header, l); tx++)
+			{
+				unsigned char* texel = tile.data();
+				for (int j = 0; j <= tileSize; j++)
+				{
+					int y = (ty * tileSize + j) % h;
+					for (int i = 0; i <= tileSize; i++, texel += 3)
+					{
+						const Eigen::Vector3f& c = level[(size_t)y * w + (tx * tileSize + i) % w];
+						texel[0] = linearToSRGB8(c.x());
+						texel[1] = linearToSRGB8(c.y());
+						texel[2] = linearToSRGB8(c.z());
+					}
+				}
+				ok = std::fwrite(tile.data(), 1, tile.size(), file) == tile.size();
+			}
+		}
+	}
+	return std::fclose(file) == 0 && ok;
+}
+
+// LRU cache of texture tiles shared by all threads.
+// The tiles are spread over shards by a hash of their key, each shard with its own lock,
+// LRU list and share of the memory, so threads looking up different tiles rarely wait on
+// each other. A lookup copies the texels it needs while holding the lock, so an evicted
+// tile is never read. Open every texture before the lookups start.
+class TextureCache
+{
+public:
+	explicit TextureCache(size_t capacityBytes = size_t(64) << 20, int shardCount = 16)
+		: capacityBytes(capacityBytes), shards(std::max(shardCount, 1))
+	{
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	~TextureCache()
+	{
+		for (std::unique_ptr<Texture>& texture : textures)
+			std::fclose(texture->file);
+	}
+
+	// open the tiled texture at @path, return its id or -1
+	// every texture must have the tile size of the first one, which sizes the cache slots
+	int open(const std::string& path)
+	{
+		std::unique_ptr<Texture> texture(new Texture());
+		texture->file = std::fopen(path.c_str(), "rb");
+		if (texture->file == nullptr)
+			return -1;
+		textureFile::Header& h = texture->header;
+		if (std::fread(&h, sizeof(h), 1, texture->file) != 1 || h.magic != textureFile::magic || h.version != textureFile::version
+			|| h.width <= 0 || h.height <= 0 || h.tileSize <= 0 || h.levelCount <= 0 || h.levelCount > 32
+			|| (!textures.empty() && h.tileSize != textures[0]->header.tileSize))
+		{
+			std::fclose(texture->file);
+			return -1;
+		}
+		int firstTile = 0;
+		for (int l = 0; l < h.levelCount; l++)
+		{
+			texture->levelTile.push_back(firstTile);
+			firstTile += textureFile::tilesX(h, l) * textureFile::tilesY(h, l);
+		}
+		if (textures.empty())
+			allocate(textureFile::tileBytes(h));
+		textures.push_back(std::move(texture));
+		return (int)textures.size() - 1;
+	}
+
+	// filtered color of @texture at @uv, wrapping outside [0, 1]
+	// @width is the footprint of the lookup in uv units, it picks the mip levels so that
+	// one texel covers about the footprint, trilinear between the two nearest levels
+	Eigen::Vector3f lookup(int texture, const Eigen::Vector2f& uv, float width)
+	{
+		STATS_INC(STAT_TEXTURE_LOOKUPS);
+		if (!std::isfinite(uv.x()) || !std::isfinite(uv.y()))	// leave the color as it is
+			return Eigen::Vector3f::Ones();
+		const Texture& t = *textures[texture];
+		float texels = width * std::max(t.header.width, t.header.height);
+		float level = texels > 1.0f ? std::log2(texels) : 0.0f;
+		level = std::min(level, (float)(t.header.levelCount - 1));
+		int l0 = (int)level;
+		float f = level - l0;
+		Eigen::Vector3f c = bilinear(texture, l0, uv);
+		if (f > 0.0f && l0 + 1 < t.header.levelCount)
+			c = (1.0f - f) * c + f * bilinear(texture, l0 + 1, uv);
+		return c;
+	}
+
+	int levelCount(int texture) const
+	{
+		return textures[texture]->header.levelCount;
+	}
+
+	// bytes of tile memory, fixed once the first texture is opened
+	size_t memoryBytes() const
+	{
+		size_t bytes = 0;
+		for (const Shard& shard : shards)
+			bytes += shard.memory.size();
+		return bytes;
+	}
+
+private:
+	struct Texture
+	{
+		FILE* file = nullptr;
+		std::mutex fileMutex;
+		textureFile::Header header;
+		std::vector<int> levelTile;	// index of the first tile of every level
+	};
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::vector<unsigned char> memory;
+		std::vector<int> freeSlots;
+		std::list<std::pair<uint64_t, int>> lru;	// key and slot, most recently used at the front
+		std::unordered_map<uint64_t, std::list<std::pair<uint64_t, int>>::iterator> index;
+	};
+
+	void allocate(size_t bytes)
+	{
+		tileBytes = bytes;
+		size_t slotsPerShard = std::max<size_t>(1, capacityBytes / tileBytes / shards.size());
+		for (Shard& shard : shards)
+		{
+			shard.memory.resize(slotsPerShard * tileBytes);
+			for (int s = (int)slotsPerShard - 1; s >= 0; s--)
+				shard.freeSlots.push_back(s);
+		}
+	}
+
+	// bilinear lookup in one level, all four texels come from the same bordered tile
+	Eigen::Vector3f bilinear(int texture, int level, const Eigen::Vector2f& uv)
+	{
+		const Texture& t = *textures[texture];
+		int w = textureFile::levelWidth(t.header, level), h = textureFile::levelHeight(t.header, level);
+		float x = uv.x() * w - 0.5f, y = uv.y() * h - 0.5f;
+		float fx = std::floor(x), fy = std::floor(y);
+		int x0 = (int)fx % w, y0 = (int)fy % h;
+		x0 += x0 < 0 ? w : 0;
+		y0 += y0 < 0 ? h : 0;
+		fx = x - fx;
+		fy = y - fy;
+		int size = t.header.tileSize;
+		int tile = t.levelTile[level] + (y0 / size) * textureFile::tilesX(t.header, level) + x0 / size;
+		int i = x0 % size, j = y0 % size;
+
+		unsigned char texels[12];
+		uint64_t key = ((uint64_t)texture << 40) | (uint64_t)tile;
+		Shard& shard = shards[(key * 0x9e3779b97f4a7c15ULL >> 32) % shards.size()];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			const unsigned char* data = fetch(shard, key, texture, tile);
+			const unsigned char* row0 = data + ((size_t)j * (size + 1) + i) * 3;
+			const unsigned char* row1 = row0 + (size + 1) * 3;
+			std::copy(row0, row0 + 6, texels);
+			std::copy(row1, row1 + 6, texels + 6);
+		}
+		const float* toLinear = srgbToLinearTable();
+		Eigen::Vector3f c;
+		for (int k = 0; k < 3; k++)
+			c[k] = (1.0f - fy) * ((1.0f - fx) * toLinear[texels[k]] + fx * toLinear[texels[3 + k]])
+				+ fy * ((1.0f - fx) * toLinear[texels[6 + k]] + fx * toLinear[texels[9 + k]]);
+		return c;
+	}
+
+	// texels of tile @key, read into the least recently used slot on a miss, call with the shard locked
+	const unsigned char* fetch(Shard& shard, uint64_t key, int texture, int tile)
+	{
+		auto it = shard.index.find(key);
+		if (it != shard.index.end())
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return &shard.memory[(size_t)it->second->second * tileBytes];
+		}
+		STATS_INC(STAT_TEXTURE_TILE_MISSES);
+		int slot;
+		if (!shard.freeSlots.empty())
+		{
+			slot = shard.freeSlots.back();
+			shard.freeSlots.pop_back();
+		}
+		else
+		{
+			slot = shard.lru.back().second;
+			shard.index.erase(shard.lru.back().first);
+			shard.lru.pop_back();
+		}
+		unsigned char* data = &shard.memory[(size_t)slot * tileBytes];
+		Texture& t = *textures[texture];
+		{
+			std::lock_guard<std::mutex> lock(t.fileMutex);
+			long long offset = (long long)sizeof(textureFile::Header) + (long long)tile * tileBytes;
+#ifdef _WIN32
+			bool ok = _fseeki64(t.file, offset, SEEK_SET) == 0;
+#else
+			bool ok = fseeko(t.file, (off_t)offset, SEEK_SET) == 0;
+#endif
+			if (!ok || std::fread(data, 1, tileBytes, t.file) != tileBytes)
+				std::fill(data, data + tileBytes, (unsigned char)0);	// a truncated file reads black
+		}
+		shard.lru.emplace_front(key, slot);
+		shard.index[key] = shard.lru.begin();
+		return data;
+	}
+
+	size_t capacityBytes;
+	size_t tileBytes = 0;
+	std::vector<std::unique_ptr<Texture>> textures;
+	std::vector<Shard> shards;
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include "sampler.hpp"
+
+// Runs a fixed set of jobs (e.g. image tiles) on a pool of worker threads.
+// Every worker owns a deque seeded with a contiguous block of jobs. A worker pops jobs from
+// the back of its own deque and, once it runs dry, steals from the front of other deques,
+// so the expensive parts of the image get shared out without a central queue.
+class TileScheduler
+{
+public:
+	explicit TileScheduler(int threadCount = 0)
+	{
+		workerCount = threadCount > 0 ? threadCount : (int)std::thread::hardware_concurrency();
+		if (workerCount <= 0)
+			workerCount = 1;
+	}
+
+	int getWorkerCount() const
+	{
+		return workerCount;
+	}
+
+	// Call job(index, worker) for every index in [0, jobCount), returns when all are done
+	void run(int jobCount, const std::function<void(int, int)>& job)
+	{
+		int workers = std::max(1, std::min(workerCount, jobCount));
+		std::vector<std::unique_ptr<WorkerQueue>> queues;
+		for (int w = 0; w < workers; w++)
+		{
+			queues.emplace_back(new WorkerQueue());
+			int begin = (int)((long long)jobCount * w / workers);
+			int end = (int)((long long)jobCount * (w + 1) / workers);
+			for (int i = begin; i < end; i++)
+				queues[w]->jobs.push_back(i);
+		}
+
+		auto work = [&](int w) {
+			Sampler victimPicker(w + 1, w);
+			while (true)
+			{
+				int index;
+				if (!queues[w]->popBack(index))
+				{
+					// own queue is empty, try every other queue starting at a random one
+					bool stolen = false;
+					int first = (int)(victimPicker.nextUInt() % workers);
+					for (int k = 0; k < workers && !stolen; k++)
+					{
+						int victim = (first + k) % workers;
+						if (victim != w)
+							stolen = queues[victim]->popFront(index);
+					}
+					if (!stolen)	// jobs are never added, so all queues are drained
+						return;
+				}
+				job(index, w);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (int w = 1; w < workers; w++)
+			threads.emplace_back(work, w);
+		work(0);
+		for (std::thread& t : threads)
+			t.join();
+	}
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<int> jobs;
+
+		bool popBack(int& index)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (jobs.empty())
+				return false;
+			index = jobs.back();
+			jobs.pop_back();
+			return true;
+		}
+
+		bool popFront(int& index)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (jobs.empty())
+				return false;
+			index = jobs.front();
+			jobs.pop_front();
+			return true;
+		}
+	};
+
+	int workerCount;
+};
@@ -1,50 +1,165 @@
 #pragma once
 #include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <tuple>
+#include <ostream>
 #include "shape.hpp"
 #include "objloader.hpp"
+#include "stats.hpp"
 
+// Octahedral encoding of a unit vector in 32 bits, 16 per axis. Codes use [0, 65534] so
+// that noNormal is never produced and can mark a vertex without a normal.
+const uint32_t noNormal = 0xffffffff;
+
+inline uint32_t encodeOctahedral(const Eigen::Vector3f& n)
+{
+	float l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+	if (l1 == 0)
+		return encodeOctahedral(Eigen::Vector3f(0, 0, 1));
+	float x = n.x() / l1, y = n.y() / l1;
+	if (n.z() < 0)	// fold the lower half over the diagonals
+	{
+		float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+		y = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+		x = fx;
+	}
+	uint32_t qx = (uint32_t)std::lround((std::min(std::max(x, -1.0f), 1.0f) + 1.0f) * 32767.0f);
+	uint32_t qy = (uint32_t)std::lround((std::min(std::max(y, -1.0f), 1.0f) + 1.0f) * 32767.0f);
+	return qx | qy << 16;
+}
+
+inline Eigen::Vector3f decodeOctahedral(uint32_t code)
+{
+	float x = (code & 0xffff) / 32767.0f - 1.0f;
+	float y = (code >> 16) / 32767.0f - 1.0f;
+	float z = 1 - std::abs(x) - std::abs(y);
+	if (z < 0)
+	{
+		float fx = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+		y = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+		x = fx;
+	}
+	return Eigen::Vector3f(x, y, z).normalized();
+}
+
+// Triangle mesh in a compact layout.
+// Every distinct position/uv/normal corner of the OBJ is welded into one vertex, so a
+// triangle is three entries of a single index buffer, 16-bit when the mesh has at most
+// 65536 vertices. Normals are octahedral codes, UVs and (after quantizePositions) positions
+// are 16-bit fixed point over their bounds. Intersection tests only read indices and
+// positions; normals and UVs are decoded once, for the closest hit.
 class TriangleMesh : public Shape
 {
 public:
 	// number of triangles
 	int triangleCount;
-	// verteces, normals and indices data
-	std::vector<Eigen::Vector3f> out_vertices;
-	std::vector<Eigen::Vector3f> out_normals;
-	std::vector<int> out_v_index;
-	std::vector<int> out_vn_index;
-	// uniform grid data
+	// number of welded vertices
+	int vertexCount;
+	// float positions, empty once quantized
+	std::vector<Eigen::Vector3f> positions;
+	// 3 per vertex, position = m_BoundingBox.lb + q * positionScale
+	std::vector<uint16_t> quantizedPositions;
+	Eigen::Vector3f positionScale;
+	// 2 per vertex, uv = uvMin + q * uvScale, empty if the mesh has no texture coordinates
+	std::vector<uint16_t> quantizedUVs;
+	Eigen::Vector2f uvMin;
+	Eigen::Vector2f uvScale;
+	// octahedral normal per vertex, noNormal if the OBJ corner had none
+	std::vector<uint32_t> normals;
+	// 3 vertices per triangle in exactly one of these
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+	// uniform grid data, the triangles of cell c are gridTriangles[gridOffsets[c], gridOffsets[c + 1])
 	bool isUniformExisting;
-	std::vector<std::vector<int>> grid;
+	std::vector<int> gridOffsets;
+	std::vector<int> gridTriangles;
 	Eigen::Vector3i gridDim;
 	Eigen::Vector3f gridDeltaDist;
+
+	// empty mesh, filled in by the caller (e.g. from a scene bundle)
+	explicit TriangleMesh(const Eigen::Vector3f& color)
+		: Shape(color), triangleCount(0), vertexCount(0), positionScale(Eigen::Vector3f::Zero()),
+		uvMin(Eigen::Vector2f::Zero()), uvScale(Eigen::Vector2f::Zero()), isUniformExisting(false)
+	{
+	}
 	
 	explicit TriangleMesh(const Eigen::Vector3f& color, std::string filePos)
-		: Shape(color)
+		: TriangleMesh(color)
 	{
-		std::vector <Eigen::Vector2f> out_uvs;
-		std::vector <int> out_vt_index;
+		std::vector<Eigen::Vector3f> out_vertices;
+		std::vector<Eigen::Vector2f> out_uvs;
+		std::vector<Eigen::Vector3f> out_normals;
+		std::vector<int> out_v_index;
+		std::vector<int> out_vt_index;
+		std::vector<int> out_vn_index;
 		loadOBJ_index(filePos.c_str(), out_vertices, out_uvs, out_normals, out_v_index, out_vt_index, out_vn_index);
-		
-		triangleCount = out_v_index.size() / 3;
-		
-		m_BoundingBox.lb = out_vertices[0].cwiseMin(out_vertices[1]);
-		m_BoundingBox.ub = out_vertices[0].cwiseMax(out_vertices[1]);
-		for (int i = 2; i < out_vertices.size(); i++)
-		{
-			m_BoundingBox.lb = m_BoundingBox.lb.cwiseMin(out_vertices[i]);
-			m_BoundingBox.ub = m_BoundingBox.ub.cwiseMax(out_vertices[i]);
-		}
+		weld(out_vertices, out_uvs, out_normals, out_v_index, out_vt_index, out_vn_index);
+		updateBoundingBox();
+	}
+
+	// vertex of corner @corner (3 * triangle + 0, 1 or 2)
+	int index(int corner) const
+	{
+		return indices16.empty() ? (int)indices32[corner] : (int)indices16[corner];
+	}
 
-		isUniformExisting = false;
+	Eigen::Vector3f position(int vertex) const
+	{
+		if (quantizedPositions.empty())
+			return positions[vertex];
+		const uint16_t* q = &quantizedPositions[3 * vertex];
+		return m_BoundingBox.lb + Eigen::Vector3f(q[0], q[1], q[2]).cwiseProduct(positionScale);
+	}
+
+	Eigen::Vector2f texCoord(int vertex) const
+	{
+		if (quantizedUVs.empty())
+			return Eigen::Vector2f::Zero();
+		const uint16_t* q = &quantizedUVs[2 * vertex];
+		return uvMin + Eigen::Vector2f(q[0], q[1]).cwiseProduct(uvScale);
+	}
+
+	// bytes held by the vertex, index and grid buffers
+	size_t memoryBytes() const
+	{
+		return positions.size() * sizeof(Eigen::Vector3f) + quantizedPositions.size() * sizeof(uint16_t)
+			+ quantizedUVs.size() * sizeof(uint16_t) + normals.size() * sizeof(uint32_t)
+			+ indices16.size() * sizeof(uint16_t) + indices32.size() * sizeof(uint32_t)
+			+ (gridOffsets.size() + gridTriangles.size()) * sizeof(int);
+	}
+
+	// store positions as 16-bit offsets in the bounding box, half the size of floats and
+	// exact to 1/65535 of the box; call after applyTransformation
+	void quantizePositions()
+	{
+		if (positions.empty())
+			return;
+		updateBoundingBox();
+		Eigen::Vector3f extent = m_BoundingBox.ub - m_BoundingBox.lb;
+		positionScale = extent / 65535.0f;
+		quantizedPositions.resize(3 * positions.size());
+		for (size_t i = 0; i < positions.size(); i++)
+			for (int k = 0; k < 3; k++)
+				quantizedPositions[3 * i + k] = extent[k] > 0
+					? (uint16_t)std::lround((positions[i][k] - m_BoundingBox.lb[k]) / extent[k] * 65535.0f) : 0;
+		std::vector<Eigen::Vector3f>().swap(positions);
 	}
 
-	// ray intersection with single triangle, result saves in @Interaction
-	bool raySingleTriangleIntersection(Interaction& interaction, const Ray& ray, int v0_idx, int v1_idx, int v2_idx)
+	// closest triangle hit found so far
+	struct TriangleHit
 	{
-		const Eigen::Vector3f& v0 = out_vertices[out_v_index[v0_idx]];
-		const Eigen::Vector3f& v1 = out_vertices[out_v_index[v1_idx]];
-		const Eigen::Vector3f& v2 = out_vertices[out_v_index[v2_idx]];
+		int triangle = -1;
+		float t, u, v;
+	};
+
+	// ray intersection with triangle @tri, replaces @closest if it is nearer
+	void rayTriangleIntersection(const Ray& ray, int tri, TriangleHit& closest) const
+	{
+		Eigen::Vector3f v0 = position(index(3 * tri));
+		Eigen::Vector3f v1 = position(index(3 * tri + 1));
+		Eigen::Vector3f v2 = position(index(3 * tri + 2));
 
 		Eigen::Vector3f v0v1 = v1 - v0;
 		Eigen::Vector3f v0v2 = v2 - v0;
@@ -53,38 +168,69 @@ public:
 
 		// ray and triangle are parallel if det is close to 0
 		if (det < 1e-10 && det > -1e-10)
-			return false;
+			return;
 
 		float invDet = 1 / det;
 
 		Eigen::Vector3f tvec = ray.m_Ori - v0;
 		float u = tvec.dot(pvec) * invDet;
 		if (u < 0 || u > 1)
-			return false;
+			return;
 
 		Eigen::Vector3f qvec = tvec.cross(v0v1);
 		float v = ray.m_Dir.dot(qvec) * invDet;
 		if (v < 0 || u + v > 1)
-			return false;
+			return;
 		
 		float t = v0v2.dot(qvec) * invDet;
 		if (t < ray.m_fMin || t > ray.m_fMax)
-			return false;
+			return;
+		if (closest.triangle == -1 || t < closest.t)
+		{
+			closest.triangle = tri;
+			closest.t = t;
+			closest.u = u;
+			closest.v = v;
+		}
+	}
+
+	// fill @interaction for the closest hit, the only place normals are decoded
+	bool setInteraction(Interaction& interaction, const Ray& ray, const TriangleHit& hit) const
+	{
+		int i0 = index(3 * hit.triangle), i1 = index(3 * hit.triangle + 1), i2 = index(3 * hit.triangle + 2);
+		interaction = Interaction();
 		interaction.isInteraction = true;
-		interaction.uv[0] = u;
-		interaction.uv[1] = v;
-		interaction.entryDist = t;
+		interaction.uv[0] = hit.u;
+		interaction.uv[1] = hit.v;
+		interaction.entryDist = hit.t;
 		interaction.entryPoint = ray.getPoint(interaction.entryDist);
 		interaction.surfaceColor = color;
-		interaction.normal = (u * out_normals[out_vn_index[v1_idx]] + v * out_normals[out_vn_index[v2_idx]] + (1 - u - v) * out_normals[out_vn_index[v0_idx]]).normalized();
-
+		if (normals[i0] == noNormal || normals[i1] == noNormal || normals[i2] == noNormal)	// face without normals
+		{
+			Eigen::Vector3f v0 = position(i0);
+			interaction.normal = (position(i1) - v0).cross(position(i2) - v0).normalized();
+		}
+		else
+			interaction.normal = (hit.u * decodeOctahedral(normals[i1]) + hit.v * decodeOctahedral(normals[i2])
+				+ (1 - hit.u - hit.v) * decodeOctahedral(normals[i0])).normalized();
+		if (texture >= 0 && !quantizedUVs.empty())
+		{
+			Eigen::Vector2f t0 = texCoord(i0), t1 = texCoord(i1), t2 = texCoord(i2);
+			Eigen::Vector3f p0 = position(i0);
+			interaction.texCoord = (1 - hit.u - hit.v) * t0 + hit.u * t1 + hit.v * t2;
+			interaction.hasTexCoord = true;
+			// square root of the ratio of the triangle's area in uv and in space
+			Eigen::Vector2f d1 = t1 - t0, d2 = t2 - t0;
+			float area = (position(i1) - p0).cross(position(i2) - p0).norm();
+			interaction.uvPerUnit = area > 0.0f ? std::sqrt(std::fabs(d1.x() * d2.y() - d1.y() * d2.x()) / area) : 0.0f;
+		}
 		return true; // this ray hits the triangle 
 	}
 
 	// ray intersection with mesh, result saves in @Interaction
 	bool rayIntersection(Interaction& interaction, const Ray& ray) override
 	{
-		Interaction finalInteraction;
+		TriangleHit closest;
 		if (isUniformExisting) {
 			Eigen::Vector3f diff = ray.m_Dir;
 			for (int i = 0; i < 3; i++) {
@@ -120,24 +266,21 @@ public:
 			tMax = tMax.cwiseQuotient(diffAbs);
 			Eigen::Vector3f tDelta = gridDeltaDist.cwiseQuotient(diffAbs);
 
-			for (int triIdx : grid[startPoint[2] * gridDim[1] * gridDim[0] + startPoint[1] * gridDim[0] + startPoint[0]]) {
-				Interaction curInteraction;
-				if (raySingleTriangleIntersection(curInteraction, ray, 3 * triIdx, 3 * triIdx + 1, 3 * triIdx + 2)) {
-					if (finalInteraction.entryDist == -1 || curInteraction.entryDist < finalInteraction.entryDist) {
-						finalInteraction = curInteraction;
-					}
-				}
+			int startCell = startPoint[2] * gridDim[1] * gridDim[0] + startPoint[1] * gridDim[0] + startPoint[0];
+			STATS_INC(STAT_GRID_CELLS);
+			STATS_ADD(STAT_TRIANGLE_TESTS, gridOffsets[startCell + 1] - gridOffsets[startCell]);
+			for (int c = gridOffsets[startCell]; c < gridOffsets[startCell + 1]; c++) {
+				rayTriangleIntersection(ray, gridTriangles[c], closest);
 			}
-			if (finalInteraction.entryDist != -1) {
-				Eigen::Vector3f curPointf = (ray.getPoint(finalInteraction.entryDist) - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
+			if (closest.triangle != -1) {
+				Eigen::Vector3f curPointf = (ray.getPoint(closest.t) - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
 				Eigen::Vector3i curPoint(floor(curPointf[0]), floor(curPointf[1]), floor(curPointf[2]));
 				curPoint = curPoint.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(gridDim - Eigen::Vector3i(1, 1, 1));
 				if (curPoint == startPoint) {
-					interaction = finalInteraction;
-					return true;
+					return setInteraction(interaction, ray, closest);
 				}
 				else {
-					finalInteraction = Interaction();
+					closest = TriangleHit();
 				}
 			}
 			Eigen::Vector3i tempPoint = startPoint;
@@ -172,115 +315,196 @@ public:
 					}
 				}
 
-				for (int triIdx : grid[tempPoint[2] * gridDim[1] * gridDim[0] + tempPoint[1] * gridDim[0] + tempPoint[0]]) {
-					Interaction curInteraction;
-					if (raySingleTriangleIntersection(curInteraction, ray, 3 * triIdx, 3 * triIdx + 1, 3 * triIdx + 2)) {
-						if (finalInteraction.entryDist == -1 || curInteraction.entryDist < finalInteraction.entryDist) {
-							finalInteraction = curInteraction;
-						}
-					}
+				int cell = tempPoint[2] * gridDim[1] * gridDim[0] + tempPoint[1] * gridDim[0] + tempPoint[0];
+				STATS_INC(STAT_GRID_CELLS);
+				STATS_ADD(STAT_TRIANGLE_TESTS, gridOffsets[cell + 1] - gridOffsets[cell]);
+				for (int c = gridOffsets[cell]; c < gridOffsets[cell + 1]; c++) {
+					rayTriangleIntersection(ray, gridTriangles[c], closest);
 				}
-				if (finalInteraction.entryDist != -1) {
-					Eigen::Vector3f curPointf = (ray.getPoint(finalInteraction.entryDist) - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
+				if (closest.triangle != -1) {
+					Eigen::Vector3f curPointf = (ray.getPoint(closest.t) - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
 					Eigen::Vector3i curPoint(floor(curPointf[0]), floor(curPointf[1]), floor(curPointf[2]));
 					curPoint = curPoint.cwiseMax(Eigen::Vector3i(0, 0, 0)).cwiseMin(gridDim - Eigen::Vector3i(1, 1, 1));
 					if (curPoint == tempPoint) {
-						interaction = finalInteraction;
-						return true;
+						return setInteraction(interaction, ray, closest);
 					}
 					else {
-						finalInteraction = Interaction();
+						closest = TriangleHit();
 					}
 				}
 			}
 		} else {
+			STATS_ADD(STAT_TRIANGLE_TESTS, triangleCount);
 			for (int i = 0; i < triangleCount; i++) {
-				Interaction curInteraction;
-				if (raySingleTriangleIntersection(curInteraction, ray, 3 * i, 3 * i + 1, 3 * i + 2)) {
-					if (finalInteraction.entryDist == -1 || curInteraction.entryDist < finalInteraction.entryDist) {
-						finalInteraction = curInteraction;
-					}
-				}
+				rayTriangleIntersection(ray, i, closest);
 			}
 		}
 
-		if (finalInteraction.entryDist != -1)
-		{
-			interaction = finalInteraction;
-			return true;
-		}
+		if (closest.triangle != -1)
+			return setInteraction(interaction, ray, closest);
 		return false;
 	}
 
 	// apply a certain transformation to all vertices, normals and bounding box
 	void applyTransformation(const Eigen::Affine3f& t)
 	{
-		for (int i = 0; i < out_vertices.size(); i++)
+		if (positions.empty())	// transform the decoded positions, quantize again afterwards
 		{
-			out_vertices[i] = t * out_vertices[i];
+			for (int i = 0; i < vertexCount; i++)
+				positions.push_back(position(i));
+			quantizedPositions.clear();
 		}
-
-		Eigen::Matrix3f tInvTr = t.linear().inverse().transpose();
-		for (int i = 0; i < out_normals.size(); i++)
+		for (int i = 0; i < (int)positions.size(); i++)
 		{
-			out_normals[i] = (tInvTr * out_normals[i]).normalized();
+			positions[i] = t * positions[i];
 		}
 
-		m_BoundingBox.lb = out_vertices[0].cwiseMin(out_vertices[1]);
-		m_BoundingBox.ub = out_vertices[0].cwiseMax(out_vertices[1]);
-		for (int i = 2; i < out_vertices.size(); i++)
+		Eigen::Matrix3f tInvTr = t.linear().inverse().transpose();
+		for (int i = 0; i < (int)normals.size(); i++)
 		{
-			m_BoundingBox.lb = m_BoundingBox.lb.cwiseMin(out_vertices[i]);
-			m_BoundingBox.ub = m_BoundingBox.ub.cwiseMax(out_vertices[i]);
+			if (normals[i] != noNormal)
+				normals[i] = encodeOctahedral((tInvTr * decodeOctahedral(normals[i])).normalized());
 		}
+
+		updateBoundingBox();
 	}
 
-	void buildUniformGrid() {
+	// @log, if given, receives the statistics of the grid
+	void buildUniformGrid(std::ostream* log = nullptr) {
 		// 1. Calculate grid size
-		float dim = powf(4 * triangleCount / std::fmaxf(m_BoundingBox.getVolume(), 0.001f), 1.f / 3);
+		float dim = powf(4 * triangleCount / std::fmax(m_BoundingBox.getVolume(), 0.001f), 1.f / 3);
 		for (int i = 0; i < 3; i++) {
 			gridDim[i] = (int)fmaxf(dim * m_BoundingBox.getDist(i), 1);
 			gridDeltaDist[i] = m_BoundingBox.getDist(i) / gridDim[i];
 		}
-		std::cout << "triangleCount:" << triangleCount << std::endl;
-		std::cout << "m_BoundingBox.lb:" << m_BoundingBox.lb[0] << " " << m_BoundingBox.lb[1] << " " << m_BoundingBox.lb[2] << std::endl;
-		std::cout << "m_BoundingBox.ub:" << m_BoundingBox.ub[0] << " " << m_BoundingBox.ub[1] << " " << m_BoundingBox.ub[2] << std::endl;
-		std::cout << "gridDim:" << gridDim[0] << " " << gridDim[1] << " " << gridDim[2] << std::endl;
-		std::cout << "gridDeltaDist:" << gridDeltaDist[0] << " " << gridDeltaDist[1] << " " << gridDeltaDist[2] << std::endl;
-
-		grid.resize(gridDim[0] * gridDim[1] * gridDim[2]);
-
-		int gridContentCount = 0;
-
-		// 2. Add triangles
-		for (int t = 0; t < triangleCount; t++) {
-			const Eigen::Vector3f& v0 = out_vertices[out_v_index[3 * t]];
-			const Eigen::Vector3f& v1 = out_vertices[out_v_index[3 * t + 1]];
-			const Eigen::Vector3f& v2 = out_vertices[out_v_index[3 * t + 2]];
-
-			AABB triBoundingBox(v0, v1, v2);
-			//std::cout << t << " triBoundingBox.lb:" << triBoundingBox.lb[0] << " " << triBoundingBox.lb[1] << " " << triBoundingBox.lb[2] << std::endl;
-			//std::cout << t << " triBoundingBox.ub:" << triBoundingBox.ub[0] << " " << triBoundingBox.ub[1] << " " << triBoundingBox.ub[2] << std::endl;
-			Eigen::Vector3f loopExtentMinf = (triBoundingBox.lb - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
-			Eigen::Vector3f loopExtentMaxf = (triBoundingBox.ub - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
-			Eigen::Vector3i loopExtentMin(floor(loopExtentMinf[0]), floor(loopExtentMinf[1]), floor(loopExtentMinf[2]));
-			Eigen::Vector3i loopExtentMax(floor(loopExtentMaxf[0]), floor(loopExtentMaxf[1]), floor(loopExtentMaxf[2]));
-			loopExtentMin = loopExtentMin.cwiseMin(gridDim - Eigen::Vector3i(1, 1, 1));
-			loopExtentMax = loopExtentMax.cwiseMin(gridDim - Eigen::Vector3i(1, 1, 1));
-			//std::cout << t << " loopExtentMin:" << loopExtentMin[0] << " " << loopExtentMin[1] << " " << loopExtentMin[2] << std::endl;
-			//std::cout << t << " loopExtentMax:" << loopExtentMax[0] << " " << loopExtentMax[1] << " " << loopExtentMax[2] << std::endl;
-			for (int i = loopExtentMin[0]; i <= loopExtentMax[0]; i++) {
-				for (int j = loopExtentMin[1]; j <= loopExtentMax[1]; j++) {
-					for (int k = loopExtentMin[2]; k <= loopExtentMax[2]; k++) {
-						grid[k * gridDim[0] * gridDim[1] + j * gridDim[0] + i].push_back(t);
-						gridContentCount++;
+
+		int cellCount = gridDim[0] * gridDim[1] * gridDim[2];
+		gridOffsets.assign(cellCount + 1, 0);
+
+		// 2. Count the triangles of every cell, then place them, so the cells end up in one flat array
+		for (int pass = 0; pass < 2; pass++) {
+			for (int t = 0; t < triangleCount; t++) {
+				Eigen::Vector3f v0 = position(index(3 * t));
+				Eigen::Vector3f v1 = position(index(3 * t + 1));
+				Eigen::Vector3f v2 = position(index(3 * t + 2));
+
+				AABB triBoundingBox(v0, v1, v2);
+				Eigen::Vector3f loopExtentMinf = (triBoundingBox.lb - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
+				Eigen::Vector3f loopExtentMaxf = (triBoundingBox.ub - m_BoundingBox.lb).cwiseQuotient(gridDeltaDist);
+				Eigen::Vector3i loopExtentMin(floor(loopExtentMinf[0]), floor(loopExtentMinf[1]), floor(loopExtentMinf[2]));
+				Eigen::Vector3i loopExtentMax(floor(loopExtentMaxf[0]), floor(loopExtentMaxf[1]), floor(loopExtentMaxf[2]));
+				loopExtentMin = loopExtentMin.cwiseMin(gridDim - Eigen::Vector3i(1, 1, 1));
+				loopExtentMax = loopExtentMax.cwiseMin(gridDim - Eigen::Vector3i(1, 1, 1));
+				for (int i = loopExtentMin[0]; i <= loopExtentMax[0]; i++) {
+					for (int j = loopExtentMin[1]; j <= loopExtentMax[1]; j++) {
+						for (int k = loopExtentMin[2]; k <= loopExtentMax[2]; k++) {
+							int cell = k * gridDim[0] * gridDim[1] + j * gridDim[0] + i;
+							if (pass == 0)
+								gridOffsets[cell + 1]++;
+							else
+								gridTriangles[gridOffsets[cell]++] = t;
+						}
 					}
 				}
 			}
+			if (pass == 0) {
+				for (int c = 0; c < cellCount; c++)
+					gridOffsets[c + 1] += gridOffsets[c];
+				gridTriangles.resize(gridOffsets[cellCount]);
+			}
+			else {
+				// filling advanced every offset to the end of its cell, shift them back
+				for (int c = cellCount; c > 0; c--)
+					gridOffsets[c] = gridOffsets[c - 1];
+				gridOffsets[0] = 0;
+			}
+		}
+		if (log != nullptr) {
+			*log << "triangleCount:" << triangleCount << std::endl;
+			*log << "m_BoundingBox.lb:" << m_BoundingBox.lb[0] << " " << m_BoundingBox.lb[1] << " " << m_BoundingBox.lb[2] << std::endl;
+			*log << "m_BoundingBox.ub:" << m_BoundingBox.ub[0] << " " << m_BoundingBox.ub[1] << " " << m_BoundingBox.ub[2] << std::endl;
+			*log << "gridDim:" << gridDim[0] << " " << gridDim[1] << " " << gridDim[2] << std::endl;
+			*log << "gridDeltaDist:" << gridDeltaDist[0] << " " << gridDeltaDist[1] << " " << gridDeltaDist[2] << std::endl;
+			*log << "gridContentCount:" << gridTriangles.size() << std::endl << std::endl;
 		}
-		std::cout << "gridContentCount:" << gridContentCount << std::endl << std::endl;
 
 		isUniformExisting = true;
 	}
 
+private:
+	// bounding box of the float positions
+	void updateBoundingBox()
+	{
+		if (positions.empty())
+			return;
+		m_BoundingBox.lb = positions[0];
+		m_BoundingBox.ub = positions[0];
+		for (int i = 1; i < (int)positions.size(); i++)
+		{
+			m_BoundingBox.lb = m_BoundingBox.lb.cwiseMin(positions[i]);
+			m_BoundingBox.ub = m_BoundingBox.ub.cwiseMax(positions[i]);
+		}
+	}
+
+	// build the vertex and index buffers from the OBJ's separate position, uv and normal
+	// indices: corners are sorted by their index triple and each distinct triple becomes
+	// one vertex, which keeps the vertices in about the order of the file
+	void weld(const std::vector<Eigen::Vector3f>& out_vertices, const std::vector<Eigen::Vector2f>& out_uvs,
+		const std::vector<Eigen::Vector3f>& out_normals, const std::vector<int>& out_v_index,
+		const std::vector<int>& out_vt_index, const std::vector<int>& out_vn_index)
+	{
+		int cornerCount = (int)out_v_index.size();
+		triangleCount = cornerCount / 3;
+		auto key = [&](int c) { return std::make_tuple(out_v_index[c], out_vt_index[c], out_vn_index[c]); };
+		std::vector<int> order(cornerCount);
+		for (int c = 0; c < cornerCount; c++)
+			order[c] = c;
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return key(a) < key(b); });
+
+		std::vector<uint32_t> cornerVertex(cornerCount);
+		std::vector<int> firstCorner;
+		for (int k = 0; k < cornerCount; k++)
+		{
+			if (k == 0 || key(order[k]) != key(order[k - 1]))
+				firstCorner.push_back(order[k]);
+			cornerVertex[order[k]] = (uint32_t)firstCorner.size() - 1;
+		}
+		vertexCount = (int)firstCorner.size();
+
+		positions.resize(vertexCount);
+		normals.resize(vertexCount);
+		bool hasUVs = false;
+		Eigen::Vector2f uvMax;
+		for (int i = 0; i < vertexCount; i++)
+		{
+			int c = firstCorner[i];
+			positions[i] = out_vertices[out_v_index[c]];
+			normals[i] = out_vn_index[c] < 0 ? noNormal : encodeOctahedral(out_normals[out_vn_index[c]].normalized());
+			if (out_vt_index[c] >= 0)
+			{
+				const Eigen::Vector2f& uv = out_uvs[out_vt_index[c]];
+				uvMin = hasUVs ? uvMin.cwiseMin(uv) : uv;
+				uvMax = hasUVs ? uvMax.cwiseMax(uv) : uv;
+				hasUVs = true;
+			}
+		}
+		if (hasUVs)
+		{
+			Eigen::Vector2f extent = uvMax - uvMin;
+			uvScale = extent / 65535.0f;
+			quantizedUVs.assign(2 * vertexCount, 0);
+			for (int i = 0; i < vertexCount; i++)
+			{
+				int vt = out_vt_index[firstCorner[i]];
+				for (int k = 0; k < 2 && vt >= 0; k++)
+					quantizedUVs[2 * i + k] = extent[k] > 0
+						? (uint16_t)std::lround((out_uvs[vt][k] - uvMin[k]) / extent[k] * 65535.0f) : 0;
+			}
+		}
+
+		if (vertexCount <= 65536)
+			indices16.assign(cornerVertex.begin(), cornerVertex.end());
+		else
+			indices32.swap(cornerVertex);
+	}
 };
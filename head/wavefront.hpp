@@ -0,0 +1,316 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "Eigen/Dense"
+#include "scene.hpp"
+#include "kdTree.hpp"
+#include "material.hpp"
+#include "photonTracing.hpp"
+#include "tileScheduler.hpp"
+
+// Photon paths in flight, one array per component.
+class PathQueue
+{
+public:
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> pr, pg, pb;
+	// PATH_* bits
+	std::vector<unsigned char> flags;
+
+	enum { PATH_DIFFUSE = 1, PATH_SPECULAR = 2 };	// the path bounced off a diffuse or a specular surface
+
+	int size() const
+	{
+		return (int)flags.size();
+	}
+
+	void clear()
+	{
+		ox.clear(); oy.clear(); oz.clear();
+		dx.clear(); dy.clear(); dz.clear();
+		pr.clear(); pg.clear(); pb.clear();
+		flags.clear();
+	}
+
+	void push(const Eigen::Vector3f& ori, const Eigen::Vector3f& dir, const Eigen::Vector3f& power, unsigned char pathFlags)
+	{
+		ox.push_back(ori.x()); oy.push_back(ori.y()); oz.push_back(ori.z());
+		dx.push_back(dir.x()); dy.push_back(dir.y()); dz.push_back(dir.z());
+		pr.push_back(power.x()); pg.push_back(power.y()); pb.push_back(power.z());
+		flags.push_back(pathFlags);
+	}
+
+	// add the paths of @other after these
+	void append(const PathQueue& other)
+	{
+		std::vector<float>* mine[9] = { &ox, &oy, &oz, &dx, &dy, &dz, &pr, &pg, &pb };
+		const std::vector<float>* theirs[9] = { &other.ox, &other.oy, &other.oz, &other.dx, &other.dy, &other.dz, &other.pr, &other.pg, &other.pb };
+		for (int c = 0; c < 9; c++)
+			mine[c]->insert(mine[c]->end(), theirs[c]->begin(), theirs[c]->end());
+		flags.insert(flags.end(), other.flags.begin(), other.flags.end());
+	}
+
+	Ray ray(int i) const
+	{
+		return Ray(Eigen::Vector3f(ox[i], oy[i], oz[i]), Eigen::Vector3f(dx[i], dy[i], dz[i]));
+	}
+
+	Eigen::Vector3f power(int i) const
+	{
+		return Eigen::Vector3f(pr[i], pg[i], pb[i]);
+	}
+};
+
+// Traces photons a whole batch at a time instead of one path at a time.
+// Every bounce runs as separate stages over the queue: intersect all rays, sort the hits by
+// material, then shade each material's hits together, compacting the surviving paths into
+// the next queue. Each stage runs one tight loop over similar work, which keeps the
+// instruction cache warm and gives the kernels a layout that vectorizes. Intersection and
+// shading both run in parallel; shading runs in fixed chunks with a random stream of their
+// own and their output is gathered in chunk order, so the maps do not depend on the threads.
+// Only photon tracing runs as wavefronts. The camera side stays per path: its specular chains
+// start only at the pixels whose first hit is specular, and adaptive and progressive sampling
+// hand out work pixel by pixel, so batches there would be small and ragged.
+class WavefrontPhotonTracer
+{
+public:
+	// number of paths started per batch
+	int batchSize = 1 << 16;
+	// number of worker threads for the intersection and shading stages, 0 uses all hardware threads
+	int threadCount = 0;
+	// seed of the shading chunks' random streams, emission uses the caller's sampler
+	uint64_t seed = 0;
+
+	explicit WavefrontPhotonTracer(Scene* scene) : scene(scene) {}
+
+	// same as globalPhotonTracing
+	int traceGlobal(PhotonMap& photonMap, int n, double timeBudget = 0.0)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		int count = 0;
+		int emitted = 0;
+		while (emitted < n && !budgetExpired(start, timeBudget))
+		{
+			queue.clear();
+			int batch = std::min(batchSize, n - emitted);
+			for (int i = 0; i < batch; i++)
+			{
+				Eigen::Vector3f ori, dir, power;
+				if (emitPhoton(scene, ori, dir, power))
+					queue.push(ori, dir, power, 0);
+			}
+			emitted += batch;
+			count += tracePaths(photonMap, false);
+		}
+		photonMap.emitted_photons += emitted;
+		return count;
+	}
+
+	// same as causticsPhotonTracing, but stops after @maxEmissions emissions, 0 for 100 n
+	int traceCaustic(PhotonMap& photonMap, int n, double timeBudget = 0.0, int maxEmissions = 0)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		CausticTargets targets(scene);
+		if (targets.empty())
+			return 0;
+		if (maxEmissions <= 0)
+			maxEmissions = 100 * n;
+		int count = 0;
+		int emitted = 0;
+		while (count < n && emitted < maxEmissions && !budgetExpired(start, timeBudget))
+		{
+			queue.clear();
+			// emit about as many paths as are still needed, every batch at least a few
+			int batch = std::min({ batchSize, std::max(n - count, 256), maxEmissions - emitted });
+			for (int i = 0; i < batch; i++)
+			{
+				Eigen::Vector3f ori, dir, power;
+				if (emitCausticPhoton(scene, targets, ori, dir, power))
+					queue.push(ori, dir, power, 0);
+			}
+			emitted += batch;
+			count += tracePaths(photonMap, true);
+		}
+		photonMap.emitted_photons += emitted;
+		return count;
+	}
+
+private:
+	static bool budgetExpired(std::chrono::steady_clock::time_point start, double timeBudget)
+	{
+		return timeBudget > 0.0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeBudget;
+	}
+
+	// run the queued paths to termination, return the number of photons stored
+	// caustic paths stop at the first diffuse hit and are only stored after a specular bounce
+	int tracePaths(PhotonMap& photonMap, bool caustic)
+	{
+		int count = 0;
+		while (queue.size() > 0)
+		{
+			intersectAll();
+			sortByMaterial();
+			count += shadeAll(photonMap, caustic);
+			std::swap(queue, next);
+		}
+		return count;
+	}
+
+	// shading stage: every material's paths in chunks of at most shadeChunk, in parallel,
+	// then the surviving paths into next and the photons into @photonMap in chunk order
+	int shadeAll(PhotonMap& photonMap, bool caustic)
+	{
+		const int shadeChunk = 1024;
+		chunks.clear();
+		for (size_t m = 0; m < materials.size(); m++)
+			for (int begin = materialBegin[m]; begin < materialBegin[m + 1]; begin += shadeChunk)
+				chunks.push_back({ (int)m, begin, std::min(begin + shadeChunk, materialBegin[m + 1]) });
+		if (chunkPaths.size() < chunks.size())
+		{
+			chunkPaths.resize(chunks.size());
+			chunkPhotons.resize(chunks.size());
+		}
+
+		// worker 0 is this thread, keep its sampler for the next emissions
+		Sampler caller = threadSampler();
+		TileScheduler scheduler(threadCount);
+		scheduler.run((int)chunks.size(), [&](int job, int) {
+			const ShadeChunk& chunk = chunks[job];
+			// streams far above those of the per-emission tracers
+			threadSampler().setSeed(seed, (uint64_t(1) << 40) + shadeStream + job);
+			chunkPaths[job].clear();
+			chunkPhotons[job].clear();
+			if (materials[chunk.material]->isSpecular)
+				shadeSpecular(chunk.begin, chunk.end, chunkPaths[job]);
+			else
+				shadeDiffuse(chunk.begin, chunk.end, caustic, chunkPaths[job], chunkPhotons[job]);
+		});
+		threadSampler() = caller;
+		shadeStream += chunks.size();
+
+		int count = 0;
+		next.clear();
+		for (size_t c = 0; c < chunks.size(); c++)
+		{
+			next.append(chunkPaths[c]);
+			const PathQueue& photons = chunkPhotons[c];
+			for (int i = 0; i < photons.size(); i++)
+				photonMap.store(Eigen::Vector3f(photons.ox[i], photons.oy[i], photons.oz[i]),
+					Eigen::Vector3f(photons.dx[i], photons.dy[i], photons.dz[i]), photons.power(i));
+			count += photons.size();
+		}
+		return count;
+	}
+
+	// intersection stage, fills hits and isHit for every queued path
+	void intersectAll()
+	{
+		int size = queue.size();
+		STATS_ADD(STAT_PHOTON_RAYS, size);
+		hits.resize(size);
+		isHit.resize(size);
+		const int chunk = 1024;
+		TileScheduler scheduler(threadCount);
+		scheduler.run((size + chunk - 1) / chunk, [&](int job, int) {
+			for (int i = job * chunk; i < std::min(size, (job + 1) * chunk); i++)
+			{
+				Ray ray = queue.ray(i);
+				ray.m_Width = scene->photonFootprint;
+				hits[i] = Interaction();
+				isHit[i] = scene->intersection(&ray, hits[i]);
+			}
+		});
+	}
+
+	// counting sort of the hit paths by material into order, paths that missed are dropped
+	void sortByMaterial()
+	{
+		materials.clear();
+		std::vector<int> materialOf(queue.size(), -1);
+		std::vector<int> counts;
+		for (int i = 0; i < queue.size(); i++)
+		{
+			if (!isHit[i])
+				continue;
+			BSDF* material = (BSDF*)hits[i].material;
+			int m = (int)(std::find(materials.begin(), materials.end(), material) - materials.begin());
+			if (m == (int)materials.size())
+			{
+				materials.push_back(material);
+				counts.push_back(0);
+			}
+			materialOf[i] = m;
+			counts[m]++;
+		}
+		materialBegin.assign(materials.size() + 1, 0);
+		for (size_t m = 0; m < materials.size(); m++)
+			materialBegin[m + 1] = materialBegin[m] + counts[m];
+		order.resize(materialBegin.back());
+		std::vector<int> fill(materialBegin.begin(), materialBegin.end() - 1);
+		for (int i = 0; i < queue.size(); i++)
+			if (materialOf[i] != -1)
+				order[fill[materialOf[i]]++] = i;
+	}
+
+	// bounce the paths order[begin, end) off a specular material into @out
+	void shadeSpecular(int begin, int end, PathQueue& out)
+	{
+		for (int k = begin; k < end; k++)
+		{
+			int i = order[k];
+			Ray ray = queue.ray(i);
+			Eigen::Vector3f power = queue.power(i);
+			if (specularBounce(hits[i], ray, power))
+				out.push(ray.m_Ori, ray.m_Dir, power, queue.flags[i] | PathQueue::PATH_SPECULAR);
+		}
+	}
+
+	// photons of the paths order[begin, end) at a diffuse material into @photons, as position,
+	// incoming direction and power, then the global paths that survive Russian roulette into @out
+	void shadeDiffuse(int begin, int end, bool caustic, PathQueue& out, PathQueue& photons)
+	{
+		for (int k = begin; k < end; k++)
+		{
+			int i = order[k];
+			Interaction& hit = hits[i];
+			unsigned char flags = queue.flags[i];
+			hit.inputDir = -Eigen::Vector3f(queue.dx[i], queue.dy[i], queue.dz[i]);
+			Eigen::Vector3f power = queue.power(i);
+			if (caustic)
+			{
+				if (flags & PathQueue::PATH_SPECULAR)	// only light - specular - diffuse paths are caustics
+					photons.push(hit.entryPoint, hit.inputDir, power, 0);
+				continue;
+			}
+			// direct light is sampled at render time and caustics come from the caustic map
+			if (flags & PathQueue::PATH_DIFFUSE)
+				photons.push(hit.entryPoint, hit.inputDir, power, 0);
+			if (!diffuseRussianRoulette(hit.surfaceColor, power))
+				continue;
+			((BSDF*)hit.material)->sample(hit);
+			out.push(hit.entryPoint, hit.outputDir, power, flags | PathQueue::PATH_DIFFUSE);
+		}
+	}
+
+	Scene* scene;
+	// paths of the current bounce and the survivors for the next one
+	PathQueue queue, next;
+	std::vector<Interaction> hits;
+	std::vector<char> isHit;
+	// path indices grouped by material, materials[m] owns order[materialBegin[m], materialBegin[m + 1])
+	std::vector<BSDF*> materials;
+	std::vector<int> materialBegin;
+	std::vector<int> order;
+	// paths order[begin, end) of one material, shaded as one job
+	struct ShadeChunk
+	{
+		int material, begin, end;
+	};
+	std::vector<ShadeChunk> chunks;
+	// per chunk output, kept between bounces so their arrays are reused
+	std::vector<PathQueue> chunkPaths, chunkPhotons;
+	// streams handed to shading chunks so far
+	uint64_t shadeStream = 0;
+};
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Render a frame with N local processes and merge the result, the same way a render
+# farm would with one process per machine.
+# usage: render_distributed.sh N [renderer] [x0 y0 x1 y1]   (run from the directory the renderer runs in)
+# the optional window crops every shard, to test the setup on a few pixels
+set -e
+N=${1:-4}
+RENDERER=${2:-./photonMapping}
+CROP=""
+if [ "$#" -ge 6 ]; then
+	CROP="--crop $3 $4 $5 $6"
+fi
+
+# trace the photon maps once, every shard loads them
+"$RENDERER" --seed 1 --save-photons photons --shard 0/1 --crop 0 0 0 0 --partial /dev/null
+
+PIDS=""
+i=0
+while [ "$i" -lt "$N" ]; do
+	# $CROP is unquoted on purpose, it is either empty or five words
+	"$RENDERER" --load-photons photons --shard "$i/$N" $CROP --partial "part$i.film" &
+	PIDS="$PIDS $!"
+	i=$((i + 1))
+done
+# a bare wait always succeeds, wait for every shard to see its status
+for PID in $PIDS; do
+	wait "$PID"
+done
+
+PARTS=""
+i=0
+while [ "$i" -lt "$N" ]; do
+	PARTS="$PARTS part$i.film"
+	i=$((i + 1))
+done
+"$RENDERER" --merge $PARTS
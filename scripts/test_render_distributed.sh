@@ -0,0 +1,22 @@
+#!/bin/sh
+# Run render_distributed.sh with 2 processes on a cropped frame and check that the merged
+# image is written, as the PFM the renderer writes itself. The renderer reads its mesh from
+# ../resources, so the run directory gets a sibling link to the resources of the source tree.
+# usage: test_render_distributed.sh renderer workdir
+set -e
+SCRIPTS=$(cd "$(dirname "$0")" && pwd)
+RENDERER=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORKDIR=$2
+
+rm -rf "$WORKDIR"
+mkdir -p "$WORKDIR/run"
+ln -s "$SCRIPTS/../resources" "$WORKDIR/resources"
+cd "$WORKDIR/run"
+
+sh "$SCRIPTS/render_distributed.sh" 2 "$RENDERER" 200 200 232 232
+for FILE in part0.film part1.film output.pfm; do
+	if [ ! -s "$FILE" ]; then
+		echo "missing $FILE" >&2
+		exit 1
+	fi
+done
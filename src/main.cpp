@@ -1,6 +1,14 @@
 ﻿
 #include <iostream>
 #include <algorithm>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <filesystem>
+#include <system_error>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -11,11 +19,147 @@
 #include "photonMappingIntegrator.hpp"
 #include "triangleMesh.hpp"
 #include "photonTracing.hpp"
-inline float clamp(float x) { return x < 0 ? 0 : x > 1 ? 1 : x; }
-inline unsigned char toInt(float x) { unsigned char c(pow(clamp(x), 1 / 2.2) * 255 + .5);return c; }
+#include "outOfCoreMap.hpp"
+#include "denoiser.hpp"
+#include "wavefront.hpp"
+#include "imageIO.hpp"
+#include "sceneBundle.hpp"
+#include "sceneDescription.hpp"
+#include "stats.hpp"
+#include "textureCache.hpp"
+#include "cameraBatch.hpp"
 
-int main()
+int main(int argc, char** argv)
 {
+	/*
+	 * 0. Distributed rendering
+	 * A frame can be split between processes, each writing a partial film that --merge adds up:
+	 *   --shard i/n            render only the tiles i, i + n, i + 2n, ...
+	 *   --crop x0 y0 x1 y1     render only the pixels in [x0, x1) x [y0, y1)
+	 *   --partial file         write the rendered pixels to a partial film instead of the image
+	 *   --seed s               seed of the photon tracing, the same seed gives the same maps
+	 *   --save-photons prefix  write the photon maps to prefix.global and prefix.caustic
+	 *   --load-photons prefix  read them back instead of tracing
+	 *   --merge file...        merge partial films into the output image and exit
+	 * Photon tracing can be split between processes by emission index:
+	 *   --photon-processes n   trace the maps with n worker processes and merge their shards
+	 *   --photon-shard i/n     as a worker, trace shard i of n into --photon-out prefix and exit
+	 *   --wavefront-photons    trace in this process in batches, stage by stage, see WavefrontPhotonTracer
+	 *   --out-of-core mb       keep the photon maps on disk, paged in through mb megabytes of memory
+	 * Time budgets in seconds, by default or if 0 none:
+	 *   --progressive          render in passes and write the image after every pass
+	 *   --photon-budget s      stop tracing photons after s seconds, split between the two maps
+	 *   --render-budget s      stop rendering after s seconds, the gather and sampling passes
+	 * Output:
+	 *   --denoise              render 32 samples a pixel and denoise the image, guided by the first hits
+	 *   --cost-maps            write heat maps of the cost of every pixel to ./cost_*.png instead of the image
+	 * Scene:
+	 *   --texture file         texture the back wall with a binary PPM or PFM, see below
+	 * Render statistics, unless built with NO_RENDER_STATS:
+	 *   --stats file           write the counters and stage times here, default ./stats.json
+	 * Batch rendering, the photon maps are traced once and every view gathers from them:
+	 *   --cameras file         render the poses in file, see readCameraPoses, to view_000.png, ...
+	 *   --orbit n,r,h          render n views on a circle of radius r around the look-at point,
+	 *                          h above it, after the poses of --cameras
+	 */
+	int tileShard = 0, tileShardCount = 1;
+	Eigen::Vector4i cropWindow(0, 0, std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+	std::string partialPath, savePhotons, loadPhotons;
+	std::vector<std::string> mergePaths;
+	uint64_t photonSeed = 0;
+	int photonProcesses = 0, photonShard = 0, photonShardCount = 0;
+	std::string photonOut;
+	bool wavefrontPhotons = false;
+	bool outOfCorePhotons = false;
+	size_t photonMemoryBudget = size_t(1) << 30;
+	bool progressive = false;
+	double photonTimeBudget = 0.0;
+	double renderTimeBudget = 0.0;
+	bool denoise = false;
+	bool costMaps = false;
+	std::string backWallTexture;
+	std::string statsPath = "./stats.json";
+	std::string camerasPath;
+	int orbitViews = 0;
+	float orbitRadius = 0.0f, orbitHeight = 0.0f;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--shard" && i + 1 < argc)
+			std::sscanf(argv[++i], "%d/%d", &tileShard, &tileShardCount);
+		else if (arg == "--crop" && i + 4 < argc)
+		{
+			for (int k = 0; k < 4; k++)
+				cropWindow[k] = std::atoi(argv[++i]);
+		}
+		else if (arg == "--partial" && i + 1 < argc)
+			partialPath = argv[++i];
+		else if (arg == "--seed" && i + 1 < argc)
+			photonSeed = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--save-photons" && i + 1 < argc)
+			savePhotons = argv[++i];
+		else if (arg == "--load-photons" && i + 1 < argc)
+			loadPhotons = argv[++i];
+		else if (arg == "--photon-processes" && i + 1 < argc)
+			photonProcesses = std::atoi(argv[++i]);
+		else if (arg == "--photon-shard" && i + 1 < argc)
+			std::sscanf(argv[++i], "%d/%d", &photonShard, &photonShardCount);
+		else if (arg == "--photon-out" && i + 1 < argc)
+			photonOut = argv[++i];
+		else if (arg == "--wavefront-photons")
+			wavefrontPhotons = true;
+		else if (arg == "--out-of-core" && i + 1 < argc)
+		{
+			long long megabytes = std::atoll(argv[++i]);
+			if (megabytes < 1)
+			{
+				std::cerr << "bad --out-of-core " << argv[i] << std::endl;
+				return 1;
+			}
+			outOfCorePhotons = true;
+			photonMemoryBudget = size_t(megabytes) << 20;
+		}
+		else if (arg == "--progressive")
+			progressive = true;
+		else if (arg == "--photon-budget" && i + 1 < argc)
+			photonTimeBudget = std::atof(argv[++i]);
+		else if (arg == "--render-budget" && i + 1 < argc)
+			renderTimeBudget = std::atof(argv[++i]);
+		else if (arg == "--denoise")
+			denoise = true;
+		else if (arg == "--cost-maps")
+			costMaps = true;
+		else if (arg == "--texture" && i + 1 < argc)
+			backWallTexture = argv[++i];
+		else if (arg == "--stats" && i + 1 < argc)
+			statsPath = argv[++i];
+		else if (arg == "--cameras" && i + 1 < argc)
+			camerasPath = argv[++i];
+		else if (arg == "--orbit" && i + 1 < argc)
+		{
+			if (std::sscanf(argv[++i], "%d,%f,%f", &orbitViews, &orbitRadius, &orbitHeight) != 3 || orbitViews < 1)
+			{
+				std::cerr << "bad --orbit " << argv[i] << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--merge")
+		{
+			while (i + 1 < argc)
+				mergePaths.push_back(argv[++i]);
+		}
+		else
+		{
+			std::cerr << "unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (tileShardCount < 1 || tileShard < 0 || tileShard >= tileShardCount)
+	{
+		std::cerr << "bad --shard " << tileShard << "/" << tileShardCount << std::endl;
+		return 1;
+	}
+
 	/*
 	 * 1. Camera Setting
 	 */
@@ -25,120 +169,372 @@ int main()
 	float verticalFov = 45;
 	Eigen::Vector2i filmRes(500, 500);
 
-	Camera camera(cameraPosition, cameraLookAt, cameraUp, verticalFov, filmRes);
-	
-
-	/*
-	 * 2. Basic geometry setting
-	 * Setting the cornell box.
-	 */
-	Eigen::Vector3f p_p0(-10, -10, -10);
-	Eigen::Vector3f p_s0(1, 0, 0);
-	Eigen::Vector3f p_s1(0, 1, 0);
-	Eigen::Vector3f p_normal(0, 0, 1);
-	Eigen::Vector3f p_color(0.7, 0.7, 0.7);
-	Parallelogram backWall(p_p0, p_s0 * 20, p_s1 * 20, p_normal, p_color);
-
-	p_p0 = Eigen::Vector3f(-6, -7, -11);
-	p_s0 = Eigen::Vector3f(0, 0, 1);
-	p_s1 = Eigen::Vector3f(0, 1, 0);
-	p_normal = Eigen::Vector3f(1, 0, 0);
-	p_color = Eigen::Vector3f(1, 0, 0);
-	Parallelogram leftWall(p_p0, p_s0 * 20, p_s1 * 20, p_normal, p_color);
-
-	p_p0 = Eigen::Vector3f(6, -7, -11);
-	p_s0 = Eigen::Vector3f(0, 0, 1);
-	p_s1 = Eigen::Vector3f(0, 1, 0);
-	p_normal = Eigen::Vector3f(-1, 0, 0);
-	p_color = Eigen::Vector3f(0, 1, 0);
-	Parallelogram rightWall(p_p0, p_s0 * 20, p_s1 * 20, p_normal, p_color);
+	// the image goes out as 8-bit sRGB, and as linear HDR to re-expose without rendering again
+	// @stem is the path without the extension
+	std::string outputStem = "./output";
+	bool writeHDR = true;
+	auto writeImage = [&](const Film& film, const std::string& stem) {
+		StageTimer timer(STAGE_OUTPUT);
+		std::vector<unsigned char> outputData = filmToSRGB8(film);
+		stbi_write_png((stem + ".png").c_str(), film.m_Res.x(), film.m_Res.y(), 3, outputData.data(), 0);
+		if (writeHDR)
+		{
+			writePFM(stem + ".pfm", film);
+			writeEXR(stem + ".exr", film);
+		}
+	};
 
-	p_p0 = Eigen::Vector3f(-7, -6, -11);
-	p_s0 = Eigen::Vector3f(1, 0, 0);
-	p_s1 = Eigen::Vector3f(0, 0, 1);
-	p_normal = Eigen::Vector3f(0, 1, 0);
-	p_color = Eigen::Vector3f(0.7, 0.7, 0.7);
-	Parallelogram floor(p_p0, p_s0 * 20, p_s1 * 20, p_normal, p_color);
+	std::vector<CameraPose> batchPoses;
+	if (!camerasPath.empty() && !readCameraPoses(camerasPath, batchPoses))
+	{
+		std::cerr << "cannot read camera poses " << camerasPath << std::endl;
+		return 1;
+	}
+	if (orbitViews > 0)
+	{
+		std::vector<CameraPose> orbit = orbitPoses(cameraLookAt, cameraUp, orbitRadius, orbitHeight, orbitViews, verticalFov);
+		batchPoses.insert(batchPoses.end(), orbit.begin(), orbit.end());
+	}
 
-	p_p0 = Eigen::Vector3f(-7, 6, -11);
-	p_s0 = Eigen::Vector3f(1, 0, 0);
-	p_s1 = Eigen::Vector3f(0, 0, 1);
-	p_normal = Eigen::Vector3f(0, -1, 0);
-	p_color = Eigen::Vector3f(0.7, 0.7, 0.7);
-	Parallelogram ceiling(p_p0, p_s0 * 20, p_s1 * 20, p_normal, p_color);
+	if (!mergePaths.empty())
+	{
+		Film merged(filmRes);
+		for (const std::string& path : mergePaths)
+		{
+			if (!mergePartialFilm(path, merged))
+			{
+				std::cerr << "cannot merge " << path << std::endl;
+				return 1;
+			}
+		}
+		writeImage(merged, outputStem);
+		return 0;
+	}
 
 	/*
-	 * 3. Triangle mesh setting
+	 * Textures are converted once to tiled, mip-mapped files next to their source and read
+	 * through a tile cache of fixed size. The back wall takes the optional --texture, delete
+	 * the .tiled file after changing the source.
 	 */
-	std::string obj_1_filePos("../resources/p.obj");
-	Eigen::Vector3f obj_1_color(1,1,1);
-	Eigen::Affine3f obj_1_transform;
-	obj_1_transform = Eigen::Translation3f(3, -2, -8) * Eigen::Scaling(0.5f);
-	TriangleMesh mesh_1(obj_1_color, obj_1_filePos);
-	mesh_1.applyTransformation(obj_1_transform);
-	mesh_1.buildUniformGrid();
-
+	size_t textureCacheBytes = size_t(64) << 20;
+	TextureCache textureCache(textureCacheBytes);
+	int backWallTextureId = -1;
+	if (!backWallTexture.empty())
+	{
+		std::string tiledPath = backWallTexture + ".tiled";
+		backWallTextureId = textureCache.open(tiledPath);
+		if (backWallTextureId == -1 && convertTexture(backWallTexture, tiledPath))
+			backWallTextureId = textureCache.open(tiledPath);
+		if (backWallTextureId == -1)
+		{
+			std::cerr << "cannot load texture " << backWallTexture << std::endl;
+			return 1;
+		}
+	}
 
 	/*
-	 * 4. Light setting
+	 * 2. Scene: the Cornell box with a glass mesh. It is built once into a bundle file and
+	 * mapped back on later runs. The bundle is keyed on the hash of the scene description,
+	 * the settings above and the contents of the mesh file included, so any change builds it
+	 * again.
 	 */
-	//Light light(Eigen::Vector3f(0, 5.99, 5), Eigen::Vector3f(1, 1, 1));
-	AreaLight light(Eigen::Vector3f(0.0f, 5.8f, -5.0f), Eigen::Vector3f(1.0f, 1.0f, 1.0f));
-	
+	std::string bundlePath = "./scene.bundle";
+	SceneDescription description = cornellBox("../resources/p.obj", backWallTextureId);
+	description.cameraPosition = cameraPosition;
+	description.cameraLookAt = cameraLookAt;
+	description.cameraUp = cameraUp;
+	description.verticalFov = verticalFov;
+	description.filmRes = filmRes;
+	// store mesh positions as 16-bit offsets in the mesh bounds instead of floats
+	description.meshes[0].quantize = true;
+	uint64_t sceneHash = description.hash();
+	SceneBundle bundle;
+	std::chrono::steady_clock::time_point sceneStart = std::chrono::steady_clock::now();
+	bool bundled = !bundlePath.empty() && sceneHash != 0 && bundle.load(bundlePath, sceneHash)
+		&& bundle.camera->m_Film.m_Res == filmRes;
+	if (!bundled)
+	{
+		description.build(bundle, &std::cout);
+		if (!bundlePath.empty() && !bundle.save(bundlePath, sceneHash))
+			std::cerr << "cannot write scene bundle " << bundlePath << std::endl;
+	}
+	std::cout << (bundled ? "scene loaded from " + bundlePath : std::string("scene built")) << " in "
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - sceneStart).count() << "s" << std::endl;
+
 
 	/*
-	 * 5. Material setting
+	 * 3. Scene integration
 	 */
-	BSDF* diffuseMat = new IdealDiffuse();
-	BSDF* specularMat = new IdealSpecular();
-	backWall.material = diffuseMat;
-	floor.material = diffuseMat;
-	leftWall.material = diffuseMat;
-	rightWall.material = diffuseMat;
-	ceiling.material = diffuseMat;
-	mesh_1.material = specularMat;
-
+	Camera& camera = *bundle.camera;
+	Scene scene;
+	bundle.addTo(scene);
+	scene.textures = &textureCache;
 
 	/*
-	 * 5. Scene integration
+	 * Photon maps. The out-of-core maps keep photons on disk in Morton-ordered bricks
+	 * and page them in through a fixed memory budget, for counts that do not fit in RAM.
+	 * The emission counts hold for every way of tracing the maps, in this process, in
+	 * shards split between processes or in wavefronts. A caustic emission stores at most
+	 * one photon, a global one may store several; an in-core map that fills up is an error.
 	 */
-	Scene scene;
-	scene.addShape(&backWall);
-	scene.addShape(&leftWall);
-	scene.addShape(&rightWall);
-	scene.addShape(&floor);
-	scene.addShape(&ceiling);
-	scene.addShape(&mesh_1);
-	scene.addLight(&light);
-	Map globalPhoton(100000, { 1.0f,1.0f,1.0f }), causticsPhoton(100000, { 1.0f,1.0f,1.0f });
-	globalPhotonTracing(&scene, globalPhoton,10000);
-	causticsPhotonTracing(&scene, causticsPhoton, { 3,-2,8 }, 10000);
-	globalPhoton.balance();
-	causticsPhoton.balance();
+	int globalEmissions = 10000;
+	int causticEmissions = 90000;
+	int globalCapacity = 10 * globalEmissions;
+	std::unique_ptr<PhotonMap> globalPhoton, causticsPhoton;
+	if (outOfCorePhotons)
+	{
+		AABB sceneBounds = scene.getBoundingBox();
+		globalPhoton.reset(new OutOfCoreMap("./global_photons", sceneBounds, { 1.0f,1.0f,1.0f }, photonMemoryBudget / 2));
+		causticsPhoton.reset(new OutOfCoreMap("./caustic_photons", sceneBounds, { 1.0f,1.0f,1.0f }, photonMemoryBudget / 2));
+	}
+	else
+	{
+		globalPhoton.reset(new Map(globalCapacity, { 1.0f,1.0f,1.0f }));
+		causticsPhoton.reset(new Map(causticEmissions, { 1.0f,1.0f,1.0f }));
+	}
+	// whether an out-of-core map could not read or write its spill or brick file
+	auto photonFilesFailed = [&]() {
+		return outOfCorePhotons && (static_cast<OutOfCoreMap*>(globalPhoton.get())->failed()
+			|| static_cast<OutOfCoreMap*>(causticsPhoton.get())->failed());
+	};
+	scene.photonFootprint = photonFootprint(scene, globalEmissions);
+	if (photonShardCount > 0)
+	{
+		// worker of a sharded photon pass: trace a slice of the emission range, unscaled and unbalanced
+		int globalBegin = (int)((long long)globalEmissions * photonShard / photonShardCount);
+		int globalEnd = (int)((long long)globalEmissions * (photonShard + 1) / photonShardCount);
+		int causticBegin = (int)((long long)causticEmissions * photonShard / photonShardCount);
+		int causticEnd = (int)((long long)causticEmissions * (photonShard + 1) / photonShardCount);
+		Map globalShard(10 * (globalEnd - globalBegin), { 1.0f,1.0f,1.0f }), causticShard(causticEnd - causticBegin, { 1.0f,1.0f,1.0f });
+		globalPhotonShard(&scene, globalShard, globalBegin, globalEnd, photonSeed);
+		causticsPhotonShard(&scene, causticShard, causticBegin, causticEnd, photonSeed);
+		if (globalShard.stored_photons == globalShard.max_photons)
+		{
+			std::cerr << "photon shard " << photonShard << ": global map full after " << globalShard.stored_photons << " photons" << std::endl;
+			return 1;
+		}
+		bool saved = globalShard.save(photonOut + ".global") && causticShard.save(photonOut + ".caustic");
+		return saved ? 0 : 1;
+	}
+	std::chrono::steady_clock::time_point photonStart = std::chrono::steady_clock::now();
+	StageTimer tracingTimer(STAGE_TRACING);
+	// saved maps are in-core maps, already scaled and balanced
+	Map* globalMap = dynamic_cast<Map*>(globalPhoton.get());
+	Map* causticMap = dynamic_cast<Map*>(causticsPhoton.get());
+	if (!loadPhotons.empty() && globalMap != nullptr && causticMap != nullptr)
+	{
+		if (!globalMap->load(loadPhotons + ".global") || !causticMap->load(loadPhotons + ".caustic"))
+		{
+			std::cerr << "cannot load photon maps " << loadPhotons << std::endl;
+			return 1;
+		}
+	}
+	else
+	{
+		// a time budget stops tracing at a different photon in every run, set none
+		// when processes regenerate the maps from the same seed
+		threadSampler().setSeed(photonSeed);
+		if (photonProcesses > 0)
+		{
+			// run the shards as child processes of this executable in a directory of their own,
+			// then gather their photons
+			std::error_code error;
+			std::filesystem::path shardDir = std::filesystem::temp_directory_path(error) / ("photon_shards_"
+				+ std::to_string(photonSeed) + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+			if (error || !std::filesystem::create_directories(shardDir, error))
+			{
+				std::cerr << "cannot create a directory for the photon shards" << std::endl;
+				return 1;
+			}
+			std::vector<std::future<int>> workers;
+			for (int i = 0; i < photonProcesses; i++)
+			{
+				std::string command = std::string("\"") + argv[0] + "\" --seed " + std::to_string(photonSeed)
+					+ " --photon-shard " + std::to_string(i) + "/" + std::to_string(photonProcesses)
+					+ " --photon-out \"" + (shardDir / ("photon_shard" + std::to_string(i))).string() + "\"";
+				workers.push_back(std::async(std::launch::async, [command]() { return std::system(command.c_str()); }));
+			}
+			bool merged = true;
+			for (int i = 0; i < photonProcesses; i++)
+				merged = workers[i].get() == 0 && merged;
+			// grow in-core maps to hold every shard's photons before appending them
+			int globalStored = 0, causticStored = 0;
+			for (int i = 0; merged && i < photonProcesses; i++)
+			{
+				std::string shard = (shardDir / ("photon_shard" + std::to_string(i))).string();
+				int stored = 0, emitted = 0;
+				merged = PhotonMap::read_counts(shard + ".global", stored, emitted);
+				globalStored += stored;
+				merged = merged && PhotonMap::read_counts(shard + ".caustic", stored, emitted);
+				causticStored += stored;
+			}
+			if (merged && globalMap != nullptr && causticMap != nullptr)
+			{
+				globalMap->reserve(globalMap->stored_photons + globalStored);
+				causticMap->reserve(causticMap->stored_photons + causticStored);
+			}
+			for (int i = 0; merged && i < photonProcesses; i++)
+			{
+				std::string shard = (shardDir / ("photon_shard" + std::to_string(i))).string();
+				merged = globalPhoton->append(shard + ".global") && causticsPhoton->append(shard + ".caustic");
+				if (!merged)
+					std::cerr << "cannot merge photon shard " << i << std::endl;
+			}
+			std::filesystem::remove_all(shardDir, error);
+			if (!merged)
+			{
+				std::cerr << "sharded photon tracing failed" << std::endl;
+				return 1;
+			}
+		}
+		else if (wavefrontPhotons)
+		{
+			WavefrontPhotonTracer tracer(&scene);
+			tracer.seed = photonSeed;
+			tracer.traceGlobal(*globalPhoton, globalEmissions, 0.5 * photonTimeBudget);
+			tracer.traceCaustic(*causticsPhoton, causticEmissions, 0.5 * photonTimeBudget, causticEmissions);
+		}
+		else
+		{
+			// the same emissions from the same random streams as the shards, so a sharded
+			// run stores the same photons
+			globalPhotonShard(&scene, *globalPhoton, 0, globalEmissions, photonSeed, 0.5 * photonTimeBudget);
+			causticsPhotonShard(&scene, *causticsPhoton, 0, causticEmissions, photonSeed, 0.5 * photonTimeBudget);
+		}
+		// merged shards fill a map grown to fit exactly, a map that filled up while tracing dropped photons
+		if (photonProcesses == 0 && globalMap != nullptr && globalMap->stored_photons == globalMap->max_photons)
+		{
+			std::cerr << "global photon map full after " << globalMap->stored_photons << " photons" << std::endl;
+			return 1;
+		}
+		tracingTimer.stop();
+		StageTimer balancingTimer(STAGE_BALANCING);
+		globalPhoton->scale_photon_power(1.0f / globalPhoton->emitted_photons);
+		causticsPhoton->scale_photon_power(1.0f / causticsPhoton->emitted_photons);
+		globalPhoton->balance();
+		causticsPhoton->balance();
+		balancingTimer.stop();
+		if (photonFilesFailed())
+		{
+			std::cerr << "cannot write the photon brick files" << std::endl;
+			return 1;
+		}
+		if (!savePhotons.empty() && globalMap != nullptr && causticMap != nullptr)
+		{
+			globalMap->save(savePhotons + ".global");
+			causticMap->save(savePhotons + ".caustic");
+		}
+	}
+	tracingTimer.stop();
+	std::cout << "photons: " << globalPhoton->stored_photons << " global, " << causticsPhoton->stored_photons << " caustic from "
+		<< globalPhoton->emitted_photons << " and " << causticsPhoton->emitted_photons << " emitted in "
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - photonStart).count() << "s" << std::endl;
 	/*std::cout << "size of pos " << photon << std::endl;
 	for (int i = 0; i < pos.size(); ++i)
 		std::cout << pos[i].x() << " " << pos[i].y() << " " << pos[i].z() << std::endl;*/
 	/*
-	 * 6. Select and execute integrator
+	 * 4. Select and execute integrator
+	 * The progressive mode writes the image after every pass. The denoiser filters the
+	 * image before it is written, guided by the first hits, so far fewer samples are needed.
+	 * The cost maps mode writes heat maps of what every pixel cost instead of the image.
 	 */
+	Denoiser denoiser;
+	if (!batchPoses.empty())
+	{
+		// views render in parallel against the shared maps, whole images only: no shards,
+		// crop window, progressive passes or cost maps
+		StageTimer renderingTimer(STAGE_RENDERING);
+		std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+		renderViews(scene, batchPoses, filmRes, *globalPhoton, *causticsPhoton, 0,
+			[&](PhotonMappingIntegrator& integrator) {
+				if (denoise)
+					integrator.samples = 32;
+			},
+			[&](int view, Camera& viewCamera, PhotonMappingIntegrator& integrator) {
+				if (denoise)
+				{
+					Denoiser viewDenoiser;
+					viewDenoiser.threadCount = integrator.threadCount;
+					viewDenoiser.denoise(viewCamera.m_Film, integrator.gBuffer);
+				}
+				char stem[32];
+				std::snprintf(stem, sizeof(stem), "./view_%03d", view);
+				writeImage(viewCamera.m_Film, stem);
+			});
+		renderingTimer.stop();
+		std::cout << batchPoses.size() << " views in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count() << "s" << std::endl;
+		if (!statsPath.empty() && !writeStats(statsPath))
+			std::cerr << "cannot write render statistics " << statsPath << std::endl;
+		if (photonFilesFailed())
+		{
+			std::cerr << "cannot read the photon brick files, the images miss photons" << std::endl;
+			return 1;
+		}
+		return 0;
+	}
 	PhotonMappingIntegrator integrator(&scene, &camera);
-	integrator.render(globalPhoton, causticsPhoton);
-
-	/*
-	 * 7. Output image to file
-	 */
-	std::string outputPath = "./output.png";
-	std::vector<unsigned char> outputData;
-	outputData.reserve(int(filmRes.x() * filmRes.y() * 3));
-	for (Eigen::Vector3f v : camera.m_Film.pixelSamples)
+	if (denoise)
+		integrator.samples = 32;
+	integrator.tileShard = tileShard;
+	integrator.tileShardCount = tileShardCount;
+	integrator.cropWindow = cropWindow;
+	integrator.progressive = progressive;
+	integrator.timeBudget = renderTimeBudget;
+	integrator.costMaps = costMaps;
+	integrator.onPass = [&](const PhotonMappingIntegrator::PassReport& report) {
+		std::cout << "pass " << report.pass << ": " << report.samples << " spp, " << report.seconds << "s (" << report.elapsed << "s total)" << std::endl;
+		if (!partialPath.empty())
+		{
+			writePartialFilm(partialPath, camera.m_Film);
+			return;
+		}
+		if (denoise)
+			denoiser.denoise(camera.m_Film, integrator.gBuffer);
+		writeImage(camera.m_Film, outputStem);
+	};
+	// in progressive mode the rendering time includes writing the image after every pass
+	StageTimer renderingTimer(STAGE_RENDERING);
+	integrator.render(*globalPhoton, *causticsPhoton);
+	renderingTimer.stop();
+	if (progressive)
 	{
-		for (int i = 0; i < 3; i++)
+		int skipped = 0;
+		for (const PhotonMappingIntegrator::PassReport& report : integrator.passReports)
+			skipped += report.skipped;
+		if (skipped > 0)
+			std::cout << skipped << " passes skipped, from pass " << integrator.passReports.size() - skipped << " on" << std::endl;
+	}
+	if (costMaps)
+	{
+		StageTimer timer(STAGE_OUTPUT);
+		const char* names[PhotonMappingIntegrator::COST_MAP_COUNT] = { "traversal", "triangles", "knn", "time" };
+		for (int map = 0; map < PhotonMappingIntegrator::COST_MAP_COUNT; map++)
 		{
-			outputData.push_back(toInt(v[i]));
+			double scale = integrator.showCostMap(map);
+			std::string path = std::string("./cost_") + names[map] + ".png";
+			std::vector<unsigned char> data = filmToSRGB8(camera.m_Film);
+			stbi_write_png(path.c_str(), camera.m_Film.m_Res.x(), camera.m_Film.m_Res.y(), 3, data.data(), 0);
+			std::cout << path << ": white at " << scale << (map == PhotonMappingIntegrator::COST_TIME ? " ns" : "") << " per pixel" << std::endl;
 		}
 	}
-	stbi_flip_vertically_on_write(true);
-	stbi_write_png(outputPath.c_str(), filmRes.x(), filmRes.y(), 3, outputData.data(), 0);
+	else if (!progressive && !partialPath.empty())
+	{
+		StageTimer timer(STAGE_OUTPUT);
+		writePartialFilm(partialPath, camera.m_Film);	// denoising needs the whole frame, partial films stay raw
+	}
+	else if (!progressive)
+	{
+		if (denoise)
+			denoiser.denoise(camera.m_Film, integrator.gBuffer);
+		writeImage(camera.m_Film, outputStem);
+	}
 
+	if (!statsPath.empty() && !writeStats(statsPath))
+		std::cerr << "cannot write render statistics " << statsPath << std::endl;
+	if (photonFilesFailed())
+	{
+		std::cerr << "cannot read the photon brick files, the image misses photons" << std::endl;
+		return 1;
+	}
 	return 0;
 }
\ No newline at end of file